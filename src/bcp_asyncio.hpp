@@ -0,0 +1,749 @@
+#ifndef __BCP_ASYNC_IO_HEADER__
+#define __BCP_ASYNC_IO_HEADER__
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#define __BCP_HAVE_IO_URING
+#endif
+#endif
+
+#include "bcp_base.hpp"
+#include "bcp_exception.hpp"
+
+/*
+  Asynchronous whole-file I/O for batch runs, so that the thread extracting
+  the codes doesn't wait for the file system: input files are read ahead
+  with prefetch() while the previous ones are being processed, and output
+  files are handed over with write_file() and written in batches in the
+  background. PPMStripReader and SavePPM6Image() take an AsyncFileIO to go
+  through it, see ppm_io.hpp.
+
+  There are two backends. UringFileIO submits opens, reads, writes and
+  closes to a Linux io_uring, talking to the kernel through the raw system
+  calls, so there's no library to link. ThreadPoolFileIO does the same
+  blocking calls on a few threads of its own. OpenAsyncFileIO() picks the
+  first one when the kernel supports it.
+*/
+
+__BCP_BEGIN_NAMESPACE
+
+
+/* Interface of the backends. Calls are made from a single thread. */
+class AsyncFileIO
+{
+public:
+    virtual ~AsyncFileIO(void) {}
+
+    // name of the backend
+    virtual const char *name(void) const = 0;
+
+    // start reading a whole file, a later read_file() of it takes the bytes
+    virtual void prefetch(const std::string &filename) = 0;
+
+    /* the contents of a file, waiting for the prefetch if there's one and
+       reading the file now otherwise. Throws cannot_open_file. */
+    virtual void read_file(const std::string &filename,
+        std::vector<byte> &data) = 0;
+
+    /* write data to a file, replacing it, some time later. The bytes are
+       taken from `data', which is left empty. */
+    virtual void write_file(const std::string &filename,
+        std::vector<byte> &data) = 0;
+
+    /* wait for the files written so far. Throws cannot_write_file for the
+       first one which failed. */
+    virtual void flush(void) = 0;
+
+    // writes submitted together
+    static const size_t write_batch = 8;
+
+    // first buffer of a read whose size isn't known, doubled as it fills
+    static const size_t read_chunk = 1 << 16;
+};
+
+
+/* Whether a file is to be read through AsyncFileIO, which loads it whole:
+   only regular files are. Pipes, FIFOs and /dev/fd/N have no size to go
+   by and may be endless streams of images, they're read as they come. */
+inline bool IsRegularFile(const std::string &filename)
+{
+    struct stat st;
+    return stat(filename.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+
+/* Blocking whole-file I/O, for ThreadPoolFileIO. They return 0 or errno. */
+inline int __read_whole_file(const std::string &filename,
+    std::vector<byte> &data)
+{
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return errno;
+
+    /* the size of a regular file is read at once, anything else is read
+       until the end */
+    struct stat st;
+    bool sized = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0;
+    size_t n = 0;
+    data.resize(sized? (size_t)st.st_size: AsyncFileIO::read_chunk);
+    for (;;)
+    {
+        if (n == data.size()) {
+            if (sized)
+                break;
+            data.resize(2 * n);
+        }
+        ssize_t r = read(fd, &data[n], data.size() - n);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0) {
+            int error = errno;
+            close(fd);
+            return error;
+        }
+        if (r == 0)
+            break;
+        n += r;
+    }
+    data.resize(n);        // the file got shorter, or wasn't sized
+    close(fd);
+    return 0;
+}
+
+inline int __write_whole_file(const std::string &filename,
+    const std::vector<byte> &data)
+{
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+        0644);
+    if (fd < 0)
+        return errno;
+
+    for (size_t n = 0; n < data.size(); )
+    {
+        ssize_t r = write(fd, &data[n], data.size() - n);
+        if ((r < 0 && errno != EINTR) || r == 0) {
+            int error = r == 0? EIO: errno;     // nothing written: give up
+            close(fd);
+            return error;
+        }
+        n += r > 0? r: 0;
+    }
+    return close(fd) == 0? 0: errno;
+}
+
+
+/* A few threads doing blocking reads and writes */
+class ThreadPoolFileIO: public AsyncFileIO
+{
+public:
+    ThreadPoolFileIO(int n_threads = 4): stopping(false)
+    {
+        for (int i = 0; i < n_threads; i++)
+            workers.push_back(std::thread(&ThreadPoolFileIO::work, this));
+    }
+
+    ~ThreadPoolFileIO(void)
+    {
+        /* the jobs posted are done before the workers leave, the writes of
+           the batch not posted yet included */
+        submit_batch();
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+    }
+
+    const char *name(void) const {
+        return "threads";
+    }
+
+    void prefetch(const std::string &filename)
+    {
+        if (reads.count(filename))
+            return;
+
+        std::shared_ptr<__file> f(new __file(filename, false));
+        reads[filename] = f;
+        post(f);
+    }
+
+    void read_file(const std::string &filename, std::vector<byte> &data)
+    {
+        prefetch(filename);
+        std::shared_ptr<__file> f = reads[filename];
+        reads.erase(filename);
+
+        wait(*f);
+        if (f->error != 0)
+            throw cannot_open_file(filename.c_str());
+        data.swap(f->data);
+    }
+
+    void write_file(const std::string &filename, std::vector<byte> &data)
+    {
+        std::shared_ptr<__file> f(new __file(filename, true));
+        f->data.swap(data);
+        batch.push_back(f);
+        if (batch.size() >= write_batch)
+            submit_batch();
+    }
+
+    void flush(void)
+    {
+        submit_batch();
+
+        std::string failed;
+        for (size_t i = 0; i < writes.size(); i++)
+        {
+            wait(*writes[i]);
+            if (writes[i]->error != 0 && failed.empty())
+                failed = writes[i]->filename;
+        }
+        writes.clear();
+
+        if (!failed.empty())
+            throw cannot_write_file(failed.c_str());
+    }
+
+private:
+    // a file being read or written by a worker
+    struct __file
+    {
+        std::string filename;
+        bool writing;
+        std::vector<byte> data;
+        int error;
+        bool done;           // under the lock
+
+        __file(const std::string &name, bool is_write)
+            : filename(name), writing(is_write), error(0), done(false) {}
+    };
+
+    // the writes of a batch are posted together
+    void submit_batch(void)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            jobs.insert(jobs.end(), batch.begin(), batch.end());
+        }
+        wake.notify_all();
+        writes.insert(writes.end(), batch.begin(), batch.end());
+        batch.clear();
+    }
+
+    void post(const std::shared_ptr<__file> &f)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            jobs.push_back(f);
+        }
+        wake.notify_one();
+    }
+
+    void wait(const __file &f)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        done.wait(lock, [&f] { return f.done; });
+    }
+
+    void work(void)
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        for (;;)
+        {
+            wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (jobs.empty())
+                return;
+
+            std::shared_ptr<__file> f = jobs.front();
+            jobs.pop_front();
+            lock.unlock();
+
+            if (f->writing) {
+                f->error = __write_whole_file(f->filename, f->data);
+                std::vector<byte>().swap(f->data);
+            }
+            else
+                f->error = __read_whole_file(f->filename, f->data);
+
+            lock.lock();
+            f->done = true;
+            done.notify_all();
+        }
+    }
+
+    std::map< std::string, std::shared_ptr<__file> > reads;   // prefetched
+    std::vector< std::shared_ptr<__file> > batch;    // writes not posted yet
+    std::vector< std::shared_ptr<__file> > writes;   // writes posted
+
+    std::vector<std::thread> workers;
+    std::deque< std::shared_ptr<__file> > jobs;
+    std::mutex mtx;
+    std::condition_variable wake, done;
+    bool stopping;
+};
+
+
+#ifdef __BCP_HAVE_IO_URING
+
+/* Whole-file I/O on an io_uring. A file goes through a few operations, each
+   one submitted when the one before it completes:
+
+     read:   OPENAT and STATX at once, READ until the size found or, when
+             it isn't a regular file, until the end, CLOSE
+     write:  OPENAT (created or truncated), WRITE until done, CLOSE
+
+   The user_data of a submission is the address of the file with the
+   operation in its 3 low bits. Submissions and completions are moved on at
+   every call, the thread blocks in the kernel only when waiting for a file
+   which isn't done yet. The rings are shared with the kernel through mmap()
+   and the system calls are made directly: we don't depend on liburing. */
+class UringFileIO: public AsyncFileIO
+{
+public:
+    /* throws exception when the kernel can't do it: too old, built without
+       io_uring or with it disabled */
+    UringFileIO(unsigned entries = 64)
+        : ring_fd(-1), sq_ring(NULL), cq_ring(NULL), sqes(NULL),
+          sq_ring_size(0), cq_ring_size(0), sqes_size(0),
+          n_queued(0), n_in_flight(0)
+    {
+        struct io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        ring_fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+        if (ring_fd < 0)
+            throw exception("io_uring is not available");
+
+        try {
+            map_rings(p);
+            probe();
+        }
+        catch (...) {
+            unmap_rings();
+            throw;
+        }
+    }
+
+    ~UringFileIO(void)
+    {
+        // the kernel may still be using buffers of ours
+        submit_batch();
+        for (size_t i = 0; i < writes.size(); i++) {
+            wait(*writes[i]);
+            delete writes[i];
+        }
+        for (std::map<std::string, __file *>::iterator i = reads.begin();
+             i != reads.end(); ++i) {
+            wait(*i->second);
+            delete i->second;
+        }
+        unmap_rings();
+    }
+
+    const char *name(void) const {
+        return "io_uring";
+    }
+
+    void prefetch(const std::string &filename)
+    {
+        if (reads.count(filename))
+            return;
+
+        __file *f = new __file(filename, false);
+        reads[filename] = f;
+        queue(f, op_openat);
+        queue(f, op_statx);
+        poll();
+    }
+
+    void read_file(const std::string &filename, std::vector<byte> &data)
+    {
+        prefetch(filename);
+        __file *f = reads[filename];
+        reads.erase(filename);
+
+        wait(*f);
+        int error = f->error;
+        data.swap(f->data);
+        delete f;
+
+        if (error != 0)
+            throw cannot_open_file(filename.c_str());
+    }
+
+    void write_file(const std::string &filename, std::vector<byte> &data)
+    {
+        __file *f = new __file(filename, true);
+        f->data.swap(data);
+        batch.push_back(f);
+        if (batch.size() >= write_batch)
+            submit_batch();
+        poll();
+    }
+
+    void flush(void)
+    {
+        submit_batch();
+
+        std::string failed;
+        for (size_t i = 0; i < writes.size(); i++)
+        {
+            wait(*writes[i]);
+            if (writes[i]->error != 0 && failed.empty())
+                failed = writes[i]->filename;
+            delete writes[i];
+        }
+        writes.clear();
+
+        if (!failed.empty())
+            throw cannot_write_file(failed.c_str());
+    }
+
+private:
+    enum __op { op_openat, op_statx, op_read, op_write, op_close };
+
+    // a file being read or written
+    struct __file
+    {
+        std::string filename;
+        bool writing;
+        std::vector<byte> data;
+        struct statx stx;
+        int fd;
+        size_t offset;       // bytes read or written so far
+        bool sized;          // read: up to the size from STATX
+        int pending;         // operations submitted and not completed
+        int error;           // errno of the first failure
+        bool done;
+
+        __file(const std::string &name, bool is_write)
+            : filename(name), writing(is_write), fd(-1), offset(0),
+              sized(false), pending(0), error(0), done(false) {}
+    };
+
+    void map_rings(const struct io_uring_params &p)
+    {
+        sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+        sq_ring = map(sq_ring_size, IORING_OFF_SQ_RING);
+        cq_ring = (p.features & IORING_FEAT_SINGLE_MMAP)?
+            sq_ring: map(cq_ring_size, IORING_OFF_CQ_RING);
+        sqes = (io_uring_sqe*)map(
+            sqes_size = p.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES);
+
+        sq_head = (unsigned*)(sq_ring + p.sq_off.head);
+        sq_tail = (unsigned*)(sq_ring + p.sq_off.tail);
+        sq_mask = *(unsigned*)(sq_ring + p.sq_off.ring_mask);
+        sq_array = (unsigned*)(sq_ring + p.sq_off.array);
+        sq_entries = p.sq_entries;
+
+        cq_head = (unsigned*)(cq_ring + p.cq_off.head);
+        cq_tail = (unsigned*)(cq_ring + p.cq_off.tail);
+        cq_mask = *(unsigned*)(cq_ring + p.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq_ring + p.cq_off.cqes);
+        cq_entries = p.cq_entries;
+    }
+
+    byte *map(size_t size, off_t offset)
+    {
+        void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+        if (p == MAP_FAILED)
+            throw exception("io_uring is not available");
+        return (byte*)p;
+    }
+
+    void unmap_rings(void)
+    {
+        if (sqes != NULL) munmap(sqes, sqes_size);
+        if (cq_ring != NULL && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+        if (sq_ring != NULL) munmap(sq_ring, sq_ring_size);
+        if (ring_fd >= 0) close(ring_fd);
+    }
+
+    // check that the kernel knows all the operations we submit
+    void probe(void)
+    {
+        const int n_ops = 256;
+        std::vector<byte> buf(
+            sizeof(io_uring_probe) + n_ops * sizeof(io_uring_probe_op), 0);
+        io_uring_probe *probe = (io_uring_probe*)&buf[0];
+        if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE,
+                probe, n_ops) < 0)
+            throw exception("io_uring is not available");
+
+        const int needed[] = { IORING_OP_OPENAT, IORING_OP_STATX,
+            IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE };
+        for (size_t i = 0; i < sizeof(needed) / sizeof(needed[0]); i++)
+        {
+            if (needed[i] > probe->last_op ||
+                !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED))
+                throw exception("io_uring is not available");
+        }
+    }
+
+    // the writes of a batch are opened together
+    void submit_batch(void)
+    {
+        for (size_t i = 0; i < batch.size(); i++)
+            queue(batch[i], op_openat);
+        writes.insert(writes.end(), batch.begin(), batch.end());
+        batch.clear();
+        poll();
+    }
+
+    // an operation to be submitted as soon as there's room for it
+    void queue(__file *f, __op op)
+    {
+        f->pending++;
+        backlog.push_back(std::make_pair(f, op));
+    }
+
+    /* fill submission entries from the backlog, as long as the completions
+       can't overflow their ring */
+    void fill_entries(void)
+    {
+        unsigned tail = *sq_tail;
+        unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        while (!backlog.empty() && tail - head < sq_entries &&
+               n_in_flight < cq_entries)
+        {
+            __file *f = backlog.front().first;
+            __op op = backlog.front().second;
+            backlog.pop_front();
+
+            unsigned index = tail & sq_mask;
+            prepare(sqes[index], f, op);
+            sq_array[index] = index;
+            tail++, n_queued++, n_in_flight++;
+        }
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+    }
+
+    void prepare(io_uring_sqe &sqe, __file *f, __op op)
+    {
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.user_data = (uint64_t)(uintptr_t)f | op;
+        switch (op)
+        {
+        case op_openat:
+            sqe.opcode = IORING_OP_OPENAT;
+            sqe.fd = AT_FDCWD;
+            sqe.addr = (uint64_t)(uintptr_t)f->filename.c_str();
+            sqe.open_flags = O_CLOEXEC |
+                (f->writing? O_WRONLY | O_CREAT | O_TRUNC: O_RDONLY);
+            sqe.len = 0644;
+            break;
+        case op_statx:
+            sqe.opcode = IORING_OP_STATX;
+            sqe.fd = AT_FDCWD;
+            sqe.addr = (uint64_t)(uintptr_t)f->filename.c_str();
+            sqe.len = STATX_TYPE | STATX_SIZE;
+            sqe.off = (uint64_t)(uintptr_t)&f->stx;
+            break;
+        case op_read:
+        case op_write:
+            sqe.opcode = op == op_read? IORING_OP_READ: IORING_OP_WRITE;
+            sqe.fd = f->fd;
+            sqe.addr = (uint64_t)(uintptr_t)(f->data.data() + f->offset);
+            sqe.len = (unsigned)std::min(f->data.size() - f->offset,
+                (size_t)1 << 30);
+            // -1 reads from the current position, as pipes need
+            sqe.off = f->writing || f->sized? f->offset: (uint64_t)-1;
+            break;
+        case op_close:
+            sqe.opcode = IORING_OP_CLOSE;
+            sqe.fd = f->fd;
+            break;
+        }
+    }
+
+    /* submit what's queued and reap the completions, waiting for at least
+       one of them when `block' */
+    void poll(bool block = false)
+    {
+        fill_entries();
+        unsigned wait_for = block && n_in_flight > 0? 1: 0;
+        if (n_queued > 0 || wait_for > 0)
+        {
+            long n = syscall(__NR_io_uring_enter, ring_fd, n_queued, wait_for,
+                wait_for > 0? IORING_ENTER_GETEVENTS: 0, NULL, 0);
+            if (n >= 0)
+                n_queued -= (unsigned)n;
+            else if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                throw exception("io_uring_enter failed");
+        }
+        reap();
+    }
+
+    void reap(void)
+    {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for ( ; head != tail; head++)
+        {
+            const io_uring_cqe &cqe = cqes[head & cq_mask];
+            __file *f = (__file*)(uintptr_t)(cqe.user_data & ~(uint64_t)7);
+            __op op = (__op)(cqe.user_data & 7);
+            int res = cqe.res;
+            n_in_flight--;
+            f->pending--;
+            complete(f, op, res);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    // move a file on after one of its operations completed with res
+    void complete(__file *f, __op op, int res)
+    {
+        if (res < 0 && res != -EINTR && res != -EAGAIN && f->error == 0)
+            f->error = -res;
+
+        switch (op)
+        {
+        case op_openat:
+            if (res >= 0) f->fd = res;
+            // fall through
+        case op_statx:
+            if (f->pending > 0)
+                break;       // the other one of a read
+            if (f->fd < 0)
+                f->done = true;
+            else if (f->error != 0)
+                queue(f, op_close);
+            else
+            {
+                if (!f->writing)
+                {
+                    f->sized = S_ISREG(f->stx.stx_mode) && f->stx.stx_size > 0;
+                    f->data.resize(f->sized? (size_t)f->stx.stx_size:
+                        read_chunk);
+                }
+                transfer(f);
+            }
+            break;
+
+        case op_read:
+        case op_write:
+            if (res == -EINTR || res == -EAGAIN)
+                transfer(f);
+            else if (res < 0)
+                queue(f, op_close);
+            else if (res == 0 && !f->writing)
+            {
+                f->data.resize(f->offset);     // shorter, or not sized
+                queue(f, op_close);
+            }
+            else if (res == 0)
+            {
+                // nothing written, retrying would loop forever
+                if (f->error == 0)
+                    f->error = EIO;
+                queue(f, op_close);
+            }
+            else
+            {
+                f->offset += res;
+                transfer(f);
+            }
+            break;
+
+        case op_close:
+            if (f->writing)
+                std::vector<byte>().swap(f->data);
+            f->done = true;
+            break;
+        }
+    }
+
+    // the next read or write of a file, or its close when all is done
+    void transfer(__file *f)
+    {
+        if (!f->writing && !f->sized && f->offset == f->data.size())
+            f->data.resize(2 * f->offset);
+        if (f->offset < f->data.size())
+            queue(f, f->writing? op_write: op_read);
+        else
+            queue(f, op_close);
+    }
+
+    void wait(const __file &f)
+    {
+        poll();
+        while (!f.done)
+            poll(true);
+    }
+
+    int ring_fd;
+    byte *sq_ring, *cq_ring;
+    io_uring_sqe *sqes;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+
+    unsigned *sq_head, *sq_tail, *sq_array, sq_mask, sq_entries;
+    unsigned *cq_head, *cq_tail, cq_mask, cq_entries;
+    io_uring_cqe *cqes;
+
+    unsigned n_queued;        // entries filled and not submitted
+    unsigned n_in_flight;     // entries filled and not completed
+    std::deque< std::pair<__file *, __op> > backlog;
+
+    std::map<std::string, __file *> reads;     // prefetched
+    std::vector<__file *> batch;               // writes not started yet
+    std::vector<__file *> writes;              // writes started
+
+    UringFileIO(const UringFileIO &);
+    const UringFileIO & operator = (const UringFileIO &);
+};
+
+#endif /* __BCP_HAVE_IO_URING */
+
+
+/* The backend for this machine: io_uring when the kernel supports it, the
+   thread pool otherwise or when the environment has BCP_IO=threads */
+inline std::unique_ptr<AsyncFileIO> OpenAsyncFileIO(void)
+{
+#ifdef __BCP_HAVE_IO_URING
+    const char *backend = getenv("BCP_IO");
+    if (backend == NULL || strcmp(backend, "threads") != 0)
+    {
+        try {
+            return std::unique_ptr<AsyncFileIO>(new UringFileIO());
+        }
+        catch (exception &) {}
+    }
+#endif
+    return std::unique_ptr<AsyncFileIO>(new ThreadPoolFileIO());
+}
+
+
+__BCP_END_NAMESPACE
+
+
+#endif /* __BCP_ASYNC_IO_HEADER__ */
@@ -0,0 +1,605 @@
+#ifndef __BCP_RESULT_CACHE_HEADER__
+#define __BCP_RESULT_CACHE_HEADER__
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <sstream>
+
+#include "bcp_image.hpp"
+#include "bcp_layout.hpp"
+#include "bcp_extract.hpp"
+#include "bcp_pack.hpp"
+#include "bcp_exception.hpp"
+
+/*
+  On-disk cache of extraction results, for scans which are submitted again.
+  A result is keyed by a hash of the pixels of the page and a hash of the
+  parameters of its layout, and is kept in a file of its own:
+
+      u32 box_x0, box_y0        u32 number of part scores
+      scores: for each part     f64 ink, edges, regularity, score
+                                u32 module
+      the record of the document in a pack, see bcp_pack.hpp
+
+  The files are found through an index which is mapped into memory, a hash
+  table of the entries and a list of them from the most to the least
+  recently used:
+
+      header                    magic "BCPC", version, sizes, list heads
+      buckets                   u32 first entry of each bucket
+      entries                   keys, size of the file, links
+
+  Entries are linked by their index in the table, ~0 ends a list. When the
+  files would take more than the size bound, or all the entries are in use,
+  the least recently used ones are evicted. The index is locked with flock()
+  while it's used, several processes may share a cache. It's in the byte
+  order of the machine, the cache is meant to stay on it.
+*/
+
+__BCP_BEGIN_NAMESPACE
+
+
+// constants and round of xxHash64
+const uint64_t __hash_p1 = 11400714785074694791ULL;
+const uint64_t __hash_p2 = 14029467366897019727ULL;
+const uint64_t __hash_p3 = 1609587929392839161ULL;
+const uint64_t __hash_p4 = 9650029242287828579ULL;
+const uint64_t __hash_p5 = 2870177450012600261ULL;
+
+inline uint64_t __hash_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t __hash_round(uint64_t acc, const byte *p)
+{
+    uint64_t input;
+    memcpy(&input, p, sizeof(input));
+    return __hash_rotl(acc + input * __hash_p2, 31) * __hash_p1;
+}
+
+/* 64-bit hash of n bytes, xxHash64: four lanes of multiply-rotate rounds
+   over 32 bytes at a time, about as fast as memory can be read */
+inline uint64_t __HashBytes(const void *data, size_t n, uint64_t seed = 0)
+{
+    const byte *p = (const byte *)data, *end = p + n;
+    uint64_t h;
+    if (n >= 32)
+    {
+        uint64_t v[4] = { seed + __hash_p1 + __hash_p2, seed + __hash_p2,
+            seed, seed - __hash_p1 };
+        for ( ; p + 32 <= end; p += 32)
+        {
+            v[0] = __hash_round(v[0], p);      v[1] = __hash_round(v[1], p + 8);
+            v[2] = __hash_round(v[2], p + 16); v[3] = __hash_round(v[3], p + 24);
+        }
+        h = __hash_rotl(v[0], 1) + __hash_rotl(v[1], 7) +
+            __hash_rotl(v[2], 12) + __hash_rotl(v[3], 18);
+        for (int i = 0; i < 4; i++)
+        {
+            byte lane[8];
+            memcpy(lane, &v[i], sizeof(lane));
+            h = (h ^ __hash_round(0, lane)) * __hash_p1 + __hash_p4;
+        }
+    }
+    else
+        h = seed + __hash_p5;
+
+    h += n;
+    for ( ; p + 8 <= end; p += 8)
+        h = __hash_rotl(h ^ __hash_round(0, p), 27) * __hash_p1 + __hash_p4;
+    if (p + 4 <= end)
+    {
+        uint32_t k;
+        memcpy(&k, p, sizeof(k));
+        h = __hash_rotl(h ^ (k * __hash_p1), 23) * __hash_p2 + __hash_p3;
+        p += 4;
+    }
+    for ( ; p < end; p++)
+        h = __hash_rotl(h ^ (*p * __hash_p5), 11) * __hash_p1;
+
+    h ^= h >> 33, h *= __hash_p2;
+    h ^= h >> 29, h *= __hash_p3;
+    return h ^ (h >> 32);
+}
+
+
+// version of the results, part of the keys: bump it when they change
+const uint32_t __cache_version = 1;
+
+/* Key of a result: the pixels of the page and everything of the layout which
+   the extraction depends on */
+struct CacheKey
+{
+    uint64_t image, params;
+};
+
+inline CacheKey MakeCacheKey(const Image<pixel_RGB> &img,
+    const InvoiceLayout &layout)
+{
+    std::vector<byte> params;
+    __put_u32(params, __cache_version);
+    __put_u32(params, (uint32_t)layout.target_x0);
+    __put_u32(params, (uint32_t)layout.target_y0);
+    __put_u32(params, (uint32_t)layout.target_width);
+    __put_u32(params, (uint32_t)layout.target_height);
+    __put_u32(params, (uint32_t)layout.code_size);
+    __put_u32(params, (uint32_t)layout.code_left);
+    __put_u32(params, (uint32_t)layout.code_padding);
+    __put_u32(params, (uint32_t)layout.max_oblique);
+    __put_u32(params, (uint32_t)layout.n_codes);
+
+    const ExtractionLimits &limits = layout.limits;
+    __put_u32(params, (uint32_t)limits.min_contrast);
+    __put_f64(params, limits.min_ink);
+    __put_f64(params, limits.max_ink);
+    __put_f64(params, limits.min_code_ink);
+    __put_f64(params, limits.stop_ink);
+    __put_u32(params, (uint32_t)limits.search_margin);
+    __put_u32(params, (uint32_t)limits.max_line_thickness);
+    __put_u32(params, (uint32_t)limits.speckle_radius);
+    __put_f64(params, limits.min_part_score);
+
+    CacheKey key;
+    key.image = __HashBytes(img.get_pixels(),
+        (size_t)img.get_width() * img.get_height() * sizeof(pixel_RGB),
+        ((uint64_t)img.get_width() << 32) | (uint64_t)img.get_height());
+    key.params = __HashBytes(&params[0], params.size());
+    return key;
+}
+
+
+const char __cache_magic[4] = {'B', 'C', 'P', 'C'};
+const uint32_t __cache_none = ~(uint32_t)0;     // end of a list
+
+struct __cache_header
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t n_buckets, capacity;   // of the hash table and the entries
+    uint64_t max_bytes;             // size bound of the files
+    uint64_t used_bytes;
+    uint32_t n_entries;
+    uint32_t free_head;             // entries not in use
+    uint32_t lru_head, lru_tail;    // most and least recently used
+};
+
+struct __cache_entry
+{
+    uint64_t image, params;         // the key
+    uint64_t size;                  // bytes of the file
+    uint32_t next;                  // in the bucket or the free list
+    uint32_t lru_prev, lru_next;
+    uint32_t pad;
+};
+
+
+// the contents of the file of a result, see above
+inline void __pack_result(const __2Dcode_Extraction &ext,
+    std::vector<byte> &data)
+{
+    __put_u32(data, (uint32_t)ext.box_x0);
+    __put_u32(data, (uint32_t)ext.box_y0);
+    __put_u32(data, (uint32_t)ext.scores.size());
+    for (size_t i = 0; i < ext.scores.size(); i++)
+    {
+        __put_f64(data, ext.scores[i].ink);
+        __put_f64(data, ext.scores[i].edges);
+        __put_f64(data, ext.scores[i].regularity);
+        __put_f64(data, ext.scores[i].score);
+        __put_u32(data, (uint32_t)ext.scores[i].module);
+    }
+    __pack_record(data, std::string(), ext);
+}
+
+inline void __unpack_result(const std::vector<byte> &data,
+    __2Dcode_Extraction &ext)
+{
+    const size_t score_size = 36;
+    if (data.size() < 12)
+        throw invalid_pack_file();
+    size_t n_scores = __get_u32(&data[8]);
+    if (n_scores > (data.size() - 12) / score_size)
+        throw invalid_pack_file();
+
+    size_t pos = 12 + n_scores * score_size;
+    PackedDocument doc;
+    __unpack_record(data.data() + pos, data.size() - pos, doc);
+
+    ext.restart();
+    ext.status = doc.status, ext.reason = doc.reason;
+    ext.box_x0 = (index_type)__get_u32(&data[0]);
+    ext.box_y0 = (index_type)__get_u32(&data[4]);
+    ext.loc.tilt = doc.tilt, ext.loc.y0 = doc.y0;
+    ext.loc.confidence = doc.confidence;
+    ext.left = doc.left;
+
+    for (size_t i = 0; i < doc.parts.size(); i++)
+    {
+        if (i == 0)
+            ext.thresholded = doc.parts[i].unpack();
+        else
+            ext.parts.push_back(doc.parts[i].unpack());
+    }
+    for (size_t i = 0; i < n_scores; i++)
+    {
+        const byte *p = &data[12 + i * score_size];
+        PartScore s;
+        s.ink        = __get_f64(p);
+        s.edges      = __get_f64(p + 8);
+        s.regularity = __get_f64(p + 16);
+        s.score      = __get_f64(p + 24);
+        s.module     = (int)__get_u32(p + 32);
+        ext.scores.push_back(s);
+    }
+}
+
+
+/* The cache, in directory `dir' which is created if needed. An index made
+   for another number of entries is emptied, processes sharing a cache must
+   agree on it. */
+class ResultCache
+{
+public:
+    ResultCache(const char *dir, uint64_t max_bytes = 256 << 20,
+        uint32_t capacity = 4096)
+        : path(dir), fd(-1), map(NULL), map_size(0), n_buckets(1),
+          capacity(capacity)
+    {
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST)
+            throw cannot_open_file(dir);
+
+        std::string index_name = path + "/index";
+        fd = open(index_name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0)
+            throw cannot_open_file(index_name.c_str());
+
+        while (n_buckets < capacity * 2) n_buckets *= 2;
+        map_size = sizeof(__cache_header) + n_buckets * sizeof(uint32_t) +
+            (size_t)capacity * sizeof(__cache_entry);
+
+        __lock lock(fd);
+        struct stat st;
+        if (fstat(fd, &st) != 0 || ((size_t)st.st_size != map_size &&
+                ftruncate(fd, map_size) != 0))
+        {
+            close(fd);
+            throw cannot_open_file(index_name.c_str());
+        }
+        void *p = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            throw cannot_open_file(index_name.c_str());
+        }
+        map = (byte *)p;
+
+        header = (__cache_header *)map;
+        buckets = (uint32_t *)(map + sizeof(__cache_header));
+        entries = (__cache_entry *)(buckets + n_buckets);
+
+        if (memcmp(header->magic, __cache_magic, 4) != 0 ||
+            header->version != __cache_version ||
+            header->n_buckets != n_buckets || header->capacity != capacity)
+            reset();
+
+        // a new size bound applies to what's in the cache already
+        header->max_bytes = max_bytes;
+        make_room(0);
+    }
+
+    ~ResultCache(void)
+    {
+        munmap(map, map_size);
+        close(fd);
+    }
+
+    /* the result of the key, into ext. Returns false when it's not in the
+       cache, ext is left as it was. */
+    bool lookup(const CacheKey &key, __2Dcode_Extraction &ext)
+    {
+        std::vector<byte> data;
+        {
+            __lock lock(fd);
+            uint32_t e = find(key);
+            if (e == __cache_none)
+                return false;
+
+            if (!read_file(file_name(key), data) || data.size() != entries[e].size)
+            {
+                evict(e);
+                return false;
+            }
+            if (!unlink_lru(e))
+                return false;
+            push_lru(e);
+        }
+
+        try {
+            __unpack_result(data, ext);
+        }
+        catch (invalid_pack_file &) {
+            // a damaged file, it would be found again every time
+            __lock lock(fd);
+            uint32_t e = find(key);
+            if (e != __cache_none)
+                evict(e);
+            return false;
+        }
+        return true;
+    }
+
+    // keep the result of the key, evicting older ones if needed
+    void store(const CacheKey &key, const __2Dcode_Extraction &ext)
+    {
+        std::vector<byte> data;
+        __pack_result(ext, data);
+
+        __lock lock(fd);
+        if (data.size() > header->max_bytes)
+            return;
+
+        uint32_t e = find(key);
+        if (e != __cache_none)
+            evict(e);
+        make_room(data.size());
+        if (header->free_head >= capacity)
+            return;         // no entries at all
+
+        // the file is complete before it gets its name
+        std::string name = file_name(key);
+        std::ostringstream tmp_name;
+        tmp_name << name << "." << getpid();
+        if (!write_file(tmp_name.str(), data) ||
+            rename(tmp_name.str().c_str(), name.c_str()) != 0)
+        {
+            unlink(tmp_name.str().c_str());
+            throw cannot_write_file(name.c_str());
+        }
+
+        e = header->free_head;
+        header->free_head = entries[e].next;
+        entries[e].image = key.image, entries[e].params = key.params;
+        entries[e].size = data.size();
+
+        uint32_t &bucket = buckets[key.image & (n_buckets - 1)];
+        entries[e].next = bucket;
+        bucket = e;
+        push_lru(e);
+        header->n_entries++;
+        header->used_bytes += data.size();
+    }
+
+    // number of results and bytes of their files
+    uint32_t n_entries(void) const { return header->n_entries; }
+    uint64_t used_bytes(void) const { return header->used_bytes; }
+
+private:
+    ResultCache(const ResultCache &);
+    const ResultCache & operator = (const ResultCache &);
+
+    // flock() of the index for the scope
+    struct __lock
+    {
+        int fd;
+        __lock(int index_fd): fd(index_fd) {
+            while (flock(fd, LOCK_EX) != 0 && errno == EINTR) {}
+        }
+        ~__lock(void) {
+            flock(fd, LOCK_UN);
+        }
+    };
+
+    // empty the index and remove the files of the results
+    void reset(void)
+    {
+        DIR *dir = opendir(path.c_str());
+        if (dir != NULL)
+        {
+            struct dirent *d;
+            while ((d = readdir(dir)) != NULL)
+            {
+                size_t len = strlen(d->d_name);
+                if (len > 5 && strcmp(d->d_name + len - 5, ".bcpr") == 0)
+                    unlink((path + "/" + d->d_name).c_str());
+            }
+            closedir(dir);
+        }
+
+        uint64_t max_bytes = header->max_bytes;     // the size bound stays
+        memset(map, 0, map_size);
+        memcpy(header->magic, __cache_magic, 4);
+        header->max_bytes = max_bytes;
+        header->version = __cache_version;
+        header->n_buckets = n_buckets, header->capacity = capacity;
+        header->lru_head = header->lru_tail = __cache_none;
+
+        for (uint32_t i = 0; i < n_buckets; i++)
+            buckets[i] = __cache_none;
+        for (uint32_t i = 0; i < capacity; i++)
+            entries[i].next = i + 1 < capacity? i + 1: __cache_none;
+        header->free_head = capacity > 0? 0: __cache_none;
+    }
+
+    /* the entry of a key, or __cache_none. A bucket can't hold more than
+       all the entries: a longer chain has a cycle, the index is corrupt and
+       is emptied. */
+    uint32_t find(const CacheKey &key)
+    {
+        uint32_t e = buckets[key.image & (n_buckets - 1)];
+        for (uint32_t steps = 0; e < capacity; e = entries[e].next, steps++)
+        {
+            if (steps == capacity) {
+                reset();
+                return __cache_none;
+            }
+            if (entries[e].image == key.image && entries[e].params == key.params)
+                return e;
+        }
+        return __cache_none;
+    }
+
+    /* evict the least recently used entries until `bytes' more fit in the
+       size bound and an entry is free. An index whose list runs out before,
+       or is longer than all the entries, is corrupt and is emptied. */
+    void make_room(uint64_t bytes)
+    {
+        for (uint32_t steps = 0;
+             header->used_bytes + bytes > header->max_bytes ||
+             header->free_head >= capacity; steps++)
+        {
+            uint32_t e = header->lru_tail;
+            if (e >= capacity || steps == capacity) {
+                reset();
+                return;
+            }
+            evict(e);
+        }
+    }
+
+    /* remove an entry and its file. The links and the sizes come from a
+       file other processes write too: when they don't hold together, the
+       index is emptied instead. */
+    void evict(uint32_t e)
+    {
+        if (e >= capacity || header->n_entries == 0 ||
+            header->used_bytes < entries[e].size) {
+            reset();
+            return;
+        }
+
+        CacheKey key = { entries[e].image, entries[e].params };
+        unlink(file_name(key).c_str());
+
+        // a corrupt index is emptied, as in find()
+        uint32_t *link = &buckets[key.image & (n_buckets - 1)];
+        for (uint32_t steps = 0; *link < capacity && *link != e; steps++)
+        {
+            if (steps == capacity) {
+                reset();
+                return;
+            }
+            link = &entries[*link].next;
+        }
+        if (*link == e)
+            *link = entries[e].next;
+
+        if (!unlink_lru(e))
+            return;
+        entries[e].next = header->free_head;
+        header->free_head = e;
+        header->n_entries--;
+        header->used_bytes -= entries[e].size;
+    }
+
+    // a link of the list of entries, which may end it
+    bool valid_link(uint32_t e) const {
+        return e < capacity || e == __cache_none;
+    }
+
+    // the index is emptied when the list is corrupt, as in evict()
+    void push_lru(uint32_t e)
+    {
+        if (!valid_link(header->lru_head)) {
+            reset();
+            return;
+        }
+        entries[e].lru_prev = __cache_none;
+        entries[e].lru_next = header->lru_head;
+        if (header->lru_head != __cache_none)
+            entries[header->lru_head].lru_prev = e;
+        else
+            header->lru_tail = e;
+        header->lru_head = e;
+    }
+
+    // returns false when the list is corrupt and the index was emptied
+    bool unlink_lru(uint32_t e)
+    {
+        uint32_t prev = entries[e].lru_prev, next = entries[e].lru_next;
+        if (!valid_link(prev) || !valid_link(next)) {
+            reset();
+            return false;
+        }
+        if (prev != __cache_none) entries[prev].lru_next = next;
+        else header->lru_head = next;
+        if (next != __cache_none) entries[next].lru_prev = prev;
+        else header->lru_tail = prev;
+        return true;
+    }
+
+    std::string file_name(const CacheKey &key) const
+    {
+        char name[40];
+        snprintf(name, sizeof(name), "/%016llx%016llx.bcpr",
+            (unsigned long long)key.image, (unsigned long long)key.params);
+        return path + name;
+    }
+
+    static bool read_file(const std::string &name, std::vector<byte> &data)
+    {
+        int file = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+        if (file < 0)
+            return false;
+
+        struct stat st;
+        bool ok = fstat(file, &st) == 0;
+        data.resize(ok? (size_t)st.st_size: 0);
+        for (size_t n = 0; ok && n < data.size(); )
+        {
+            ssize_t r = read(file, &data[n], data.size() - n);
+            if (r < 0 && errno == EINTR)
+                continue;
+            ok = r > 0;
+            n += ok? (size_t)r: 0;
+        }
+        close(file);
+        return ok;
+    }
+
+    static bool write_file(const std::string &name, const std::vector<byte> &data)
+    {
+        int file = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+            0644);
+        if (file < 0)
+            return false;
+
+        bool ok = true;
+        for (size_t n = 0; ok && n < data.size(); )
+        {
+            ssize_t r = write(file, &data[n], data.size() - n);
+            if (r < 0 && errno == EINTR)
+                continue;
+            ok = r > 0;
+            n += ok? (size_t)r: 0;
+        }
+        return close(file) == 0 && ok;
+    }
+
+    std::string path;          // of the directory
+    int fd;                    // of the index
+    byte *map;
+    size_t map_size;
+    uint32_t n_buckets, capacity;      // of the index as we map it
+    __cache_header *header;
+    uint32_t *buckets;
+    __cache_entry *entries;
+};
+
+
+__BCP_END_NAMESPACE
+
+
+#endif /* __BCP_RESULT_CACHE_HEADER__ */
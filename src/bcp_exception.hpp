@@ -33,6 +33,7 @@ protected:
 __BCP_DECLARE_EXCEPTION(invalid_ppm_image,          "Invalid PPM image");
 __BCP_DECLARE_EXCEPTION(unrecognized_ppm_format,    "Unrecognized PPM file format");
 __BCP_DECLARE_EXCEPTION(cannot_open_specified_file, "Cannot open specified file");
+__BCP_DECLARE_EXCEPTION(invalid_pack_file,          "Invalid packed output file");
 
 
 class cannot_open_file: public exception
@@ -44,6 +45,24 @@ public:
     }
 };
 
+class cannot_write_file: public exception
+{
+public:
+    cannot_write_file(const char *filename)
+        : exception(std::string(
+                "Cannot write file: " + std::string(filename)).c_str()) {
+    }
+};
+
+class invalid_layout_file: public exception
+{
+public:
+    invalid_layout_file(const char *filename, int line)
+        : exception(std::string("Invalid layout file: " +
+                std::string(filename) + ":" + std::to_string(line)).c_str()) {
+    }
+};
+
 
 
 __BCP_END_NAMESPACE
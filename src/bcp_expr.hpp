@@ -0,0 +1,494 @@
+#ifndef __BCP_EXPR_HEADER__
+#define __BCP_EXPR_HEADER__
+
+
+#include <assert.h>
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+
+#include "bcp_image_def.hpp"
+#include "bcp_kernels.hpp"
+#include "bcp_parallel.hpp"
+#include "bcp_proc.hpp"
+
+/*
+  Lazy image expressions. img.lazy() starts an expression on an image, the
+  operations chained after it (crop, threshold, rotate, transpose, convert)
+  don't create any image, they only describe how each pixel of the result is
+  computed from the source. The whole chain is evaluated in one loop when
+  it's assigned to an Image, or saved:
+
+      Image<pixel_Monochrome> mono = img.lazy().crop(l,r,t,b).threshold(128);
+
+  reads each source pixel in the rect once and writes each output pixel
+  once. Pixel types are converted through ConvertPixel(), which is resolved
+  at compile time.
+
+  An expression keeps a reference to the image it starts from, the image has
+  to outlive it.
+*/
+
+__BCP_BEGIN_NAMESPACE
+
+
+template <typename _expr_type> class CropExpr;
+template <typename _expr_type> class ThresholdExpr;
+template <typename _expr_type> class RotateExpr;
+template <typename _expr_type> class TransposeExpr;
+template <typename _expr_type, typename _pixel_ty_to> class ConvertExpr;
+
+template <bool _value> struct __bool_tag {};
+
+
+/* Base of all expressions (CRTP). Each expression defines:
+
+       pixel_type                 type of the resulting pixels
+       has_rows                   whether rows of the result are contiguous
+                                  pixels of an image in memory
+       get_width(), get_height()  size of the result
+       operator () (m, n)         value of the pixel (m, n) of the result
+       eval_row(n, out)           compute row n of the result into out[]
+       row(n)                     pointer to row n, only when has_rows
+*/
+template <typename _derived>
+class ImageExpr
+{
+public:
+    const _derived &self(void) const {
+        return static_cast<const _derived &>(*this);
+    }
+
+    // lazy versions of the operations of Image
+    CropExpr<_derived> crop(index_type left, index_type right,
+        index_type top, index_type bottom) const;
+    ThresholdExpr<_derived> threshold(int thrld) const;
+    ThresholdExpr<_derived> threshold(void) const;
+    RotateExpr<_derived> rotate(double rad, index_type cx, index_type cy) const;
+    TransposeExpr<_derived> transpose(void) const;
+
+    template <typename _pixel_ty_to>
+    ConvertExpr<_derived, _pixel_ty_to> convert(void) const;
+
+    // accumulate the grayscale histogram of the result into histogram[256]
+    void gray_histogram(int *histogram) const {
+        __HistogramOfExpr(self(), histogram, __bool_tag<_derived::has_rows>());
+    }
+
+    // evaluate the expression, rows are evaluated in bands on exec
+    template <typename _pixel_type>
+    void eval_to(Image<_pixel_type> &img,
+        const ExecutionPolicy &exec = SerialPolicy()) const;
+
+    // evaluate the expression and save the result as a PPM6 image
+    void save_ppm(const char *ppm_filename) const;
+};
+
+
+/* Leaf of expressions: an existing image */
+template <typename _pixel_type>
+class ImageRef: public ImageExpr< ImageRef<_pixel_type> >
+{
+public:
+    typedef _pixel_type pixel_type;
+    static const bool has_rows = true;
+
+    ImageRef(const Image<pixel_type> &image): img(&image) {}
+
+    size_type get_width(void)  const { return img->get_width(); }
+    size_type get_height(void) const { return img->get_height(); }
+
+    const pixel_type &operator () (index_type m, index_type n) const {
+        assert(m >= 0 && m < get_width() && n >= 0 && n < get_height());
+        return img->get_pixels()[n * get_width() + m];
+    }
+
+    const pixel_type *row(index_type n) const {
+        return img->get_pixels() + n * get_width();
+    }
+
+    void eval_row(index_type n, pixel_type *out) const {
+        std::copy(row(n), row(n) + get_width(), out);
+    }
+
+private:
+    const Image<pixel_type> *img;
+};
+
+
+/* Rows of an expression without contiguous rows are computed pixel by pixel */
+template <typename _expr_type, typename _pixel_type>
+void __eval_row_by_pixels(
+    const _expr_type &expr, index_type n, _pixel_type *out)
+{
+    for (index_type m = 0; m < expr.get_width(); m++) {
+        out[m] = ConvertPixel(expr(m, n), _pixel_type());
+    }
+}
+
+
+/* Crop: the rect [left, right] x [top, bottom] of the source */
+template <typename _expr_type>
+class CropExpr: public ImageExpr< CropExpr<_expr_type> >
+{
+public:
+    typedef typename _expr_type::pixel_type pixel_type;
+    static const bool has_rows = _expr_type::has_rows;
+
+    CropExpr(const _expr_type &source, index_type left, index_type right,
+        index_type top, index_type bottom)
+        : src(source), x0(left), y0(top),
+          width(right - left + 1), height(bottom - top + 1)
+    {
+        assert(left < right && top < bottom);
+    }
+
+    size_type get_width(void)  const { return width; }
+    size_type get_height(void) const { return height; }
+
+    pixel_type operator () (index_type m, index_type n) const {
+        return src(x0 + m, y0 + n);
+    }
+
+    const pixel_type *row(index_type n) const {
+        return src.row(y0 + n) + x0;
+    }
+
+    void eval_row(index_type n, pixel_type *out) const {
+        eval_row(n, out, __bool_tag<has_rows>());
+    }
+
+private:
+    void eval_row(index_type n, pixel_type *out, __bool_tag<true>) const {
+        std::copy(row(n), row(n) + width, out);
+    }
+    void eval_row(index_type n, pixel_type *out, __bool_tag<false>) const {
+        __eval_row_by_pixels(*this, n, out);
+    }
+
+    _expr_type src;
+    index_type x0, y0;
+    size_type width, height;
+};
+
+
+/* Thresholding a row of contiguous pixels, RGB and grayscale rows are done
+   by the pixel kernels */
+template <typename _pixel_type>
+void __threshold_row(const _pixel_type *src, pixel_Monochrome *out,
+    size_type n, int threshold)
+{
+    for (index_type i = 0; i < n; i++) {
+        out[i] = ThresholdPixel(src[i], threshold);
+    }
+}
+
+inline void __threshold_row(const pixel_RGB *src, pixel_Monochrome *out,
+    size_type n, int threshold)
+{
+    PixelKernels().rgb_threshold((const byte*)src, (int*)out, n, threshold);
+}
+
+inline void __threshold_row(const pixel_Grayscale *src, pixel_Monochrome *out,
+    size_type n, int threshold)
+{
+    PixelKernels().gray_threshold((const int*)src, (int*)out, n, threshold);
+}
+
+/* Grayscale histogram of a row of contiguous pixels */
+template <typename _pixel_type>
+void __histogram_row(const _pixel_type *src, size_type n, int *histogram)
+{
+    for (index_type i = 0; i < n; i++) {
+        histogram[ConvertPixel(src[i], pixel_Grayscale()).val]++;
+    }
+}
+
+inline void __histogram_row(const pixel_RGB *src, size_type n, int *histogram)
+{
+    PixelKernels().rgb_histogram((const byte*)src, n, histogram);
+}
+
+
+/* Accumulate the grayscale histogram of the result of an expression */
+template <typename _expr_type>
+void __HistogramOfExpr(const _expr_type &expr, int *histogram, __bool_tag<true>)
+{
+    for (index_type n = 0; n < expr.get_height(); n++) {
+        __histogram_row(expr.row(n), expr.get_width(), histogram);
+    }
+}
+
+template <typename _expr_type>
+void __HistogramOfExpr(const _expr_type &expr, int *histogram, __bool_tag<false>)
+{
+    for (index_type n = 0; n < expr.get_height(); n++)
+    {
+        for (index_type m = 0; m < expr.get_width(); m++) {
+            histogram[ConvertPixel(expr(m, n), pixel_Grayscale()).val]++;
+        }
+    }
+}
+
+
+/* Threshold: monochrome version of the source, see ThresholdImage */
+template <typename _expr_type>
+class ThresholdExpr: public ImageExpr< ThresholdExpr<_expr_type> >
+{
+public:
+    typedef pixel_Monochrome pixel_type;
+    static const bool has_rows = false;
+
+    ThresholdExpr(const _expr_type &source, int thrld)
+        : src(source), threshold(thrld) {}
+
+    // pick up the threshold with Otsu's method, it costs an extra pass
+    ThresholdExpr(const _expr_type &source): src(source)
+    {
+        int histogram[256] = {0};
+        source.gray_histogram(histogram);
+        threshold = __OtsuThreshold(histogram,
+            source.get_width() * source.get_height());
+    }
+
+    size_type get_width(void)  const { return src.get_width(); }
+    size_type get_height(void) const { return src.get_height(); }
+
+    pixel_type operator () (index_type m, index_type n) const {
+        return ThresholdPixel(src(m, n), threshold);
+    }
+
+    void eval_row(index_type n, pixel_type *out) const {
+        eval_row(n, out, __bool_tag<_expr_type::has_rows>());
+    }
+
+    int get_threshold(void) const {
+        return threshold;
+    }
+
+private:
+    void eval_row(index_type n, pixel_type *out, __bool_tag<true>) const {
+        __threshold_row(src.row(n), out, get_width(), threshold);
+    }
+    void eval_row(index_type n, pixel_type *out, __bool_tag<false>) const {
+        __eval_row_by_pixels(*this, n, out);
+    }
+
+    _expr_type src;
+    int threshold;
+};
+
+
+/* Rotate: the source rotated around (cx, cy), see RotateImage */
+template <typename _expr_type>
+class RotateExpr: public ImageExpr< RotateExpr<_expr_type> >
+{
+public:
+    typedef typename _expr_type::pixel_type pixel_type;
+    static const bool has_rows = false;
+
+    RotateExpr(const _expr_type &source, double rad,
+        index_type center_x, index_type center_y)
+        : src(source), sin_phi(std::sin(rad)), cos_phi(std::cos(rad)),
+          cx(center_x), cy(center_y),
+          white_pixel(ConvertPixel(pixel_RGB(255,255,255), pixel_type())) {}
+
+    size_type get_width(void)  const { return src.get_width(); }
+    size_type get_height(void) const { return src.get_height(); }
+
+    pixel_type operator () (index_type x, index_type y) const
+    {
+        // the same mapping as RotateImage()
+        int tx = x - cx, ty = y - cy;
+        double rx_d = tx * cos_phi - ty * sin_phi,
+               ry_d = tx * sin_phi + ty * cos_phi;
+        index_type rx = (index_type)(rx_d + 0.5) + cx,
+                   ry = (index_type)(ry_d + 0.5) + cy;
+
+        if (rx >= 0 && rx < src.get_width() &&
+            ry >= 0 && ry < src.get_height())
+        {
+            return src(rx,ry);    // in bound
+        }
+        return white_pixel;       // outside world rolled in
+    }
+
+    void eval_row(index_type n, pixel_type *out) const {
+        __eval_row_by_pixels(*this, n, out);
+    }
+
+private:
+    _expr_type src;
+    double sin_phi, cos_phi;
+    index_type cx, cy;
+    pixel_type white_pixel;
+};
+
+
+/* Transpose */
+template <typename _expr_type>
+class TransposeExpr: public ImageExpr< TransposeExpr<_expr_type> >
+{
+public:
+    typedef typename _expr_type::pixel_type pixel_type;
+    static const bool has_rows = false;
+
+    TransposeExpr(const _expr_type &source): src(source) {}
+
+    size_type get_width(void)  const { return src.get_height(); }
+    size_type get_height(void) const { return src.get_width(); }
+
+    pixel_type operator () (index_type m, index_type n) const {
+        return src(n, m);
+    }
+
+    void eval_row(index_type n, pixel_type *out) const {
+        __eval_row_by_pixels(*this, n, out);
+    }
+
+private:
+    _expr_type src;
+};
+
+
+/* Convert: the source with pixels converted to _pixel_ty_to */
+template <typename _expr_type, typename _pixel_ty_to>
+class ConvertExpr: public ImageExpr< ConvertExpr<_expr_type, _pixel_ty_to> >
+{
+public:
+    typedef _pixel_ty_to pixel_type;
+    static const bool has_rows = false;
+
+    ConvertExpr(const _expr_type &source): src(source) {}
+
+    size_type get_width(void)  const { return src.get_width(); }
+    size_type get_height(void) const { return src.get_height(); }
+
+    pixel_type operator () (index_type m, index_type n) const {
+        return ConvertPixel(src(m, n), pixel_type());
+    }
+
+    void eval_row(index_type n, pixel_type *out) const {
+        __eval_row_by_pixels(*this, n, out);
+    }
+
+private:
+    _expr_type src;
+};
+
+
+// operations of ImageExpr, each one wraps the expression in a new one
+template <typename _derived>
+CropExpr<_derived> ImageExpr<_derived>::crop(
+    index_type left, index_type right, index_type top, index_type bottom) const
+{
+    return CropExpr<_derived>(self(), left, right, top, bottom);
+}
+
+template <typename _derived>
+ThresholdExpr<_derived> ImageExpr<_derived>::threshold(int thrld) const {
+    return ThresholdExpr<_derived>(self(), thrld);
+}
+
+template <typename _derived>
+ThresholdExpr<_derived> ImageExpr<_derived>::threshold(void) const {
+    return ThresholdExpr<_derived>(self());
+}
+
+template <typename _derived>
+RotateExpr<_derived> ImageExpr<_derived>::rotate(
+    double rad, index_type cx, index_type cy) const
+{
+    return RotateExpr<_derived>(self(), rad, cx, cy);
+}
+
+template <typename _derived>
+TransposeExpr<_derived> ImageExpr<_derived>::transpose(void) const {
+    return TransposeExpr<_derived>(self());
+}
+
+template <typename _derived>
+template <typename _pixel_ty_to>
+ConvertExpr<_derived, _pixel_ty_to> ImageExpr<_derived>::convert(void) const {
+    return ConvertExpr<_derived, _pixel_ty_to>(self());
+}
+
+
+/* Evaluate an expression into img, one row at a time. Results of a different
+   pixel type are converted through ConvertPixel(). */
+template <typename _expr_type, typename _pixel_type>
+void __eval_expr_row(const _expr_type &expr, index_type n, _pixel_type *out,
+    __bool_tag<false>)
+{
+    __eval_row_by_pixels(expr, n, out);
+}
+
+template <typename _expr_type, typename _pixel_type>
+void __eval_expr_row(const _expr_type &expr, index_type n, _pixel_type *out,
+    __bool_tag<true>)
+{
+    expr.eval_row(n, out);
+}
+
+template <typename _derived>
+template <typename _pixel_type>
+void ImageExpr<_derived>::eval_to(
+    Image<_pixel_type> &img, const ExecutionPolicy &exec) const
+{
+    typedef __bool_tag<std::is_same<
+        typename _derived::pixel_type, _pixel_type>::value> same_pixel_type;
+
+    const _derived &expr = self();
+    size_type width = expr.get_width();
+
+    /* the expression may read img itself (img = img.lazy()...), it's
+       evaluated into a new image which replaces img at the end */
+    Image<_pixel_type> result(width, expr.get_height());
+    ParallelRows(exec, expr.get_height(), width * sizeof(_pixel_type),
+        [&](index_type y_begin, index_type y_end)
+    {
+        for (index_type y = y_begin; y < y_end; y++) {
+            __eval_expr_row(expr, y, result.get_pixels() + y * width,
+                same_pixel_type());
+        }
+    });
+    img.swap(result);
+}
+
+template <typename _derived>
+void ImageExpr<_derived>::save_ppm(const char *ppm_filename) const
+{
+    Image<typename _derived::pixel_type> img;
+    eval_to(img);
+    img.save_ppm(ppm_filename);
+}
+
+
+// Image members dealing with expressions
+template <typename _pixel_type>
+ImageRef<_pixel_type> Image<_pixel_type>::lazy(void) const {
+    return ImageRef<_pixel_type>(*this);
+}
+
+template <typename _pixel_type>
+template <typename _expr_type>
+Image<_pixel_type>::Image(const ImageExpr<_expr_type> &expr)
+    : width(0), height(0), px(NULL)
+{
+    expr.eval_to(*this);
+}
+
+template <typename _pixel_type>
+template <typename _expr_type>
+const Image<_pixel_type> & Image<_pixel_type>::operator = (
+    const ImageExpr<_expr_type> &expr)
+{
+    expr.eval_to(*this);
+    return *this;
+}
+
+
+__BCP_END_NAMESPACE
+
+
+#endif /* __BCP_EXPR_HEADER__ */
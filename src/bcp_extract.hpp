@@ -0,0 +1,348 @@
+#ifndef __BCP_EXTRACT_HEADER__
+#define __BCP_EXTRACT_HEADER__
+
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include "bcp_image.hpp"
+#include "bcp_locate.hpp"
+#include "bcp_layout.hpp"
+#include "bcp_pyramid.hpp"
+#include "bcp_morph.hpp"
+#include "bcp_score.hpp"
+
+
+__BCP_BEGIN_NAMESPACE
+
+
+/* Outcome of the extraction of a page */
+enum ExtractionStatus
+{
+    EXTRACTION_OK = 0,
+    EXTRACTION_REJECTED        // see the reason
+};
+
+/* Why a page was rejected, see ExtractionLimits */
+enum RejectReason
+{
+    REJECT_NONE = 0,
+    REJECT_PAGE_TOO_SMALL,     // the target box doesn't fit in the page
+    REJECT_BLANK,              // no contrast in the target box
+    REJECT_TOO_LITTLE_INK,
+    REJECT_TOO_MUCH_INK,
+    REJECT_NO_CODE_ROW,        // no band of ink as tall as a code
+    REJECT_REASON_COUNT        // the number of reasons, not a reason
+};
+
+// name of a reason, "unknown" for values read from a damaged file
+inline const char *RejectReasonName(RejectReason reason)
+{
+    static const char *names[REJECT_REASON_COUNT] = {
+        "none", "page-too-small", "blank", "too-little-ink", "too-much-ink",
+        "no-code-row"
+    };
+    if ((unsigned)reason >= (unsigned)REJECT_REASON_COUNT)
+        return "unknown";
+    return names[reason];
+}
+
+
+/* Everything we got from a single invoice image. When the page is rejected
+   there are no parts, and `thresholded' is only meaningful for pages
+   rejected for REJECT_NO_CODE_ROW. */
+struct __2Dcode_Extraction
+{
+    ExtractionStatus status;
+    RejectReason reason;
+    index_type box_x0, box_y0; // where the target box was cropped
+    Image<pixel_Monochrome> thresholded;  // roughly cropped target box
+    __2Dcode_Location loc;     // tilt and vertical location of the code row
+    index_type left;           // horizontal position of the first 2D code
+    std::vector< Image<pixel_Monochrome> > parts;   // the splitted 2D codes
+    std::vector<PartScore> scores;   // how much each part looks like a code
+
+    __2Dcode_Extraction(void) {
+        restart();
+    }
+
+    bool ok(void) const {
+        return status == EXTRACTION_OK;
+    }
+
+    // start over for another page
+    void restart(void) {
+        status = EXTRACTION_OK, reason = REJECT_NONE;
+        box_x0 = box_y0 = 0;
+        loc.y0 = 0, loc.tilt = 0, loc.confidence = 0;
+        left = 0;
+        parts.clear();
+        scores.clear();
+    }
+
+    void reject(RejectReason why) {
+        status = EXTRACTION_REJECTED, reason = why;
+    }
+};
+
+
+/* Cheap checks on the histogram of the target box, before thresholding it:
+   a blank page has no contrast between the gray levels below and above the
+   threshold, and a page with codes has some ink but is not all ink. */
+inline RejectReason __CheckTargetHistogram(
+    const int histogram[256], int size, int threshold,
+    const ExtractionLimits &limits)
+{
+    double ink = 0, ink_sum = 0, paper_sum = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        if (i < threshold)
+            ink += histogram[i], ink_sum += (double)i * histogram[i];
+        else
+            paper_sum += (double)i * histogram[i];
+    }
+
+    double paper = size - ink;
+    if (ink == 0 || paper == 0 ||
+        paper_sum / paper - ink_sum / ink < limits.min_contrast)
+        return REJECT_BLANK;
+    if (ink < limits.min_ink * size)
+        return REJECT_TOO_LITTLE_INK;
+    if (ink > limits.max_ink * size)
+        return REJECT_TOO_MUCH_INK;
+    return REJECT_NONE;
+}
+
+
+/* Whether the target box of the layout fits in a page of width x height */
+template <typename _layout_type>
+bool __TargetBoxFits(const _layout_type &layout,
+    size_type width, size_type height)
+{
+    return layout.target_x0 >= 0 && layout.target_y0 >= 0 &&
+        layout.target_x0 + layout.target_width < width &&
+        layout.target_y0 + layout.target_height < height;
+}
+
+/* The extraction pipeline, from the roughly cropped target box on: check
+   and threshold the box, calibrate the horizonal tilt with tomography
+   projection, then split the 2D codes apart. Results are stored in `ext'.
+   The whole-image operations run on the given execution policy.
+
+   The geometry comes from `layout', an InvoiceLayout or a
+   StaticInvoiceLayout, whose members are then compile-time constants. With
+   a prior, the tilt search starts from the tilt of the previous page of the
+   same source.
+
+   Pages without a plausible row of codes are rejected as early as possible,
+   ext.status and ext.reason tell whether and why. Each part is scored by
+   ScorePart(), parts scoring less than limits.min_part_score are cropped
+   again around the ink nearby, the better of the two crops is kept. */
+template <typename _layout_type, typename _box_type>
+void __Extract2DCodesInBox(const ImageExpr<_box_type> &target_box,
+    const _layout_type &layout, const ExtractionLimits &limits,
+    __2Dcode_Extraction &ext, const ExecutionPolicy &exec,
+    LocationPrior *prior)
+{
+    const size_type code_size = layout.code_size;
+    const _box_type &box = target_box.self();
+
+    // Check the histogram and threshold the box
+    int histogram[256] = {0}, size = box.get_width() * box.get_height();
+    box.gray_histogram(histogram);
+    int threshold = __OtsuThreshold(histogram, size);
+
+    RejectReason reason =
+        __CheckTargetHistogram(histogram, size, threshold, limits);
+    if (reason != REJECT_NONE) {
+        ext.reject(reason);
+        return;
+    }
+
+    box.threshold(threshold).eval_to(ext.thresholded, exec);
+    CleanMonochrome(ext.thresholded, code_size,
+        limits.max_line_thickness, limits.speckle_radius);
+
+    // Coarse projection: the densest band as tall as a code without tilt
+    std::vector<int> rows = TomographyProjection(ext.thresholded, 0);
+    __2Dcode_Location coarse = __Estimate2DcodeLocation(rows, code_size);
+    if (coarse.confidence <
+        limits.min_code_ink * code_size * ext.thresholded.get_width())
+    {
+        ext.reject(REJECT_NO_CODE_ROW);
+        return;
+    }
+
+    // Horizonal tilt calibration
+    int stop_confidence = (int)(
+        limits.stop_ink * code_size * ext.thresholded.get_width());
+    if (prior != NULL)
+        ext.loc = Locate2DCode(ext.thresholded, layout.max_oblique,
+            code_size, *prior, stop_confidence);
+    else
+        ext.loc = Locate2DCode(ext.thresholded, layout.max_oblique,
+            code_size, stop_confidence);
+
+    // Rotate, crop precisely and transpose for the vertical crop, only the
+    // rotated pixels in the code row are computed
+    Image<pixel_Monochrome> img_trans;
+    ext.thresholded.lazy().rotate(std::atan(ext.loc.tilt), 0, 0)
+        .crop(0, 0 + layout.target_width, ext.loc.y0, ext.loc.y0 + code_size)
+        .transpose().eval_to(img_trans, exec);
+
+    // Vertical crop
+    std::vector<int> tomo_array = TomographyProjection(img_trans, 0);
+    __PiecewiseIntegration(tomo_array.begin(), tomo_array.end(), code_size);
+
+    // estimate the position of the first 2D code
+    std::vector<int>::iterator itr = std::max_element(
+        tomo_array.begin(), tomo_array.begin() + layout.code_left);
+    ext.left = (index_type)(itr - tomo_array.begin());
+
+    // split the 2D codes
+    for (int i = 0, top = ext.left; i < layout.n_codes;
+         i++, top += (code_size + layout.code_padding))
+    {
+        ext.parts.push_back(img_trans.lazy()
+            .crop(0, code_size, top, top + code_size).transpose());
+        ext.scores.push_back(ScorePart(ext.parts.back()));
+
+        if (ext.scores.back().score >= limits.min_part_score)
+            continue;
+
+        /* re-crop where the most ink is, within a quarter of a code, the
+           integrated projection holds the ink of each crop */
+        index_type lo = std::max(top - code_size / 4, 0);
+        index_type hi = std::min(top + code_size / 4,
+            img_trans.get_height() - code_size - 1);
+        if (lo > hi)
+            continue;
+
+        index_type best = (index_type)(std::max_element(
+            tomo_array.begin() + lo, tomo_array.begin() + hi + 1) -
+            tomo_array.begin());
+        if (best == top)
+            continue;
+
+        Image<pixel_Monochrome> part = img_trans.lazy()
+            .crop(0, code_size, best, best + code_size).transpose();
+        PartScore score = ScorePart(part);
+        if (score.score > ext.scores.back().score) {
+            ext.parts.back() = part;
+            ext.scores.back() = score;
+        }
+    }
+}
+
+/* The whole extraction pipeline on a page in memory: crop the target box
+   roughly, where the layout has it or where LocateTargetBox() finds the
+   codes, and go on with __Extract2DCodesInBox() */
+template <typename _layout_type, typename _pixel_type>
+void __Extract2DCodes(const Image<_pixel_type> &img,
+    const _layout_type &layout, const ExtractionLimits &limits,
+    __2Dcode_Extraction &ext, const ExecutionPolicy &exec,
+    LocationPrior *prior)
+{
+    ext.restart();
+    if (!__TargetBoxFits(layout, img.get_width(), img.get_height())) {
+        ext.reject(REJECT_PAGE_TOO_SMALL);
+        return;
+    }
+
+    ext.box_x0 = layout.target_x0, ext.box_y0 = layout.target_y0;
+    if (limits.search_margin > 0)
+        LocateTargetBox(img, layout, limits.search_margin,
+            ext.box_x0, ext.box_y0, exec);
+
+    __Extract2DCodesInBox(img.lazy().crop(
+        ext.box_x0, ext.box_x0 + layout.target_width,
+        ext.box_y0, ext.box_y0 + layout.target_height),
+        layout, limits, ext, exec, prior);
+}
+
+/* The same on a page being read by `reader': only the rows of the target box
+   are loaded, one strip at a time, so that memory use is bounded by the size
+   of the box and not by the size of the page. With a search margin, the
+   area around the box is loaded too. */
+template <typename _layout_type>
+void __Extract2DCodes(PPMStripReader &reader,
+    const _layout_type &layout, const ExtractionLimits &limits,
+    __2Dcode_Extraction &ext, const ExecutionPolicy &exec,
+    LocationPrior *prior)
+{
+    ext.restart();
+    if (!__TargetBoxFits(layout, reader.get_width(), reader.get_height())) {
+        ext.reject(REJECT_PAGE_TOO_SMALL);
+        return;
+    }
+
+    // the target box and the margin around it
+    int margin = std::max(limits.search_margin, 0);
+    index_type left = std::max(layout.target_x0 - margin, 0);
+    index_type top  = std::max(layout.target_y0 - margin, 0);
+    index_type right = std::min(
+        layout.target_x0 + layout.target_width + margin,
+        reader.get_width() - 1);
+    index_type bottom = std::min(
+        layout.target_y0 + layout.target_height + margin,
+        reader.get_height() - 1);
+
+    Image<pixel_RGB> region;
+    LoadPPMRegion(reader, left, right, top, bottom, region);
+
+    // the box, relative to the region
+    index_type box_x0 = layout.target_x0 - left;
+    index_type box_y0 = layout.target_y0 - top;
+    if (margin > 0)
+        LocateTargetBox(region, layout, margin, box_x0, box_y0, exec);
+    ext.box_x0 = left + box_x0, ext.box_y0 = top + box_y0;
+
+    __Extract2DCodesInBox(region.lazy().crop(
+        box_x0, box_x0 + layout.target_width,
+        box_y0, box_y0 + layout.target_height),
+        layout, limits, ext, exec, prior);
+}
+
+/* Extract the 2D codes of an invoice of the given layout, invoices of the
+   default layout go through the specialized pipeline. Pass the prior of the
+   source of the invoice, if any, to warm-start the tilt search. */
+template <typename _pixel_type>
+void Extract2DCodes(const Image<_pixel_type> &img,
+    const InvoiceLayout &layout, __2Dcode_Extraction &ext,
+    const ExecutionPolicy &exec = SerialPolicy(), LocationPrior *prior = NULL)
+{
+    if (layout.same_geometry(InvoiceLayout()))
+        __Extract2DCodes(img, DefaultInvoiceLayout(), layout.limits,
+            ext, exec, prior);
+    else
+        __Extract2DCodes(img, layout, layout.limits, ext, exec, prior);
+}
+
+/* Extract the 2D codes of an invoice being read by `reader', in constant
+   memory, see above */
+inline void Extract2DCodes(PPMStripReader &reader,
+    const InvoiceLayout &layout, __2Dcode_Extraction &ext,
+    const ExecutionPolicy &exec = SerialPolicy(), LocationPrior *prior = NULL)
+{
+    if (layout.same_geometry(InvoiceLayout()))
+        __Extract2DCodes(reader, DefaultInvoiceLayout(), layout.limits,
+            ext, exec, prior);
+    else
+        __Extract2DCodes(reader, layout, layout.limits, ext, exec, prior);
+}
+
+/* Extract the 2D codes of an invoice of the default layout */
+template <typename _pixel_type>
+void Extract2DCodes(const Image<_pixel_type> &img, __2Dcode_Extraction &ext,
+    const ExecutionPolicy &exec = SerialPolicy())
+{
+    __Extract2DCodes(img, DefaultInvoiceLayout(), ExtractionLimits(),
+        ext, exec, NULL);
+}
+
+
+__BCP_END_NAMESPACE
+
+
+#endif /* __BCP_EXTRACT_HEADER__ */
@@ -7,6 +7,7 @@
 
 #include "bcp_image_def.hpp"
 #include "bcp_proc.hpp"
+#include "bcp_expr.hpp"
 
 
 __BCP_BEGIN_NAMESPACE
@@ -20,8 +21,8 @@ Image<_pixel_type>::Image(size_type image_width, size_type image_height)
       px(new Image<_pixel_type>::pixel_type[
               image_width * image_height])
 {
-    // initialize each pixel as its default color, resulting an "blank" image
-    std::fill_n(px, width * height, Image<_pixel_type>::pixel_type());
+    /* each pixel has already been initialized as its default color by new[],
+       resulting an "blank" image */
 }
 
 // Initialize an image object with a PPM image file.
@@ -65,6 +66,14 @@ const Image<_pixel_type> & Image<_pixel_type>::operator = (
     return *this;  // convention of operator = ()
 }
 
+template <typename _pixel_type>
+void Image<_pixel_type>::swap(Image<pixel_type> &img)
+{
+    std::swap(width, img.width);
+    std::swap(height, img.height);
+    std::swap(px, img.px);
+}
+
 
 // get image metrics
 template <typename _pixel_type>
@@ -111,6 +120,36 @@ Image<_pixel_type>::operator () (index_type m, index_type n) const {
     return this->get_pixel_const(m, n);
 }
 
+// Obtain the pixel array, pixels are stored row by row
+template <typename _pixel_type>
+typename Image<_pixel_type>::pixel_type *
+Image<_pixel_type>::get_pixels(void) {
+    return this->px;
+}
+
+template <typename _pixel_type>
+const typename Image<_pixel_type>::pixel_type *
+Image<_pixel_type>::get_pixels(void) const {
+    return this->px;
+}
+
+// Obtain the pixels of a row, the bounds are checked once for the row
+template <typename _pixel_type>
+typename Image<_pixel_type>::row_type
+Image<_pixel_type>::row(index_type y)
+{
+    assert(y >= 0 && y < height);
+    return this->px + (size_t)y * width;
+}
+
+template <typename _pixel_type>
+typename Image<_pixel_type>::const_row_type
+Image<_pixel_type>::row(index_type y) const
+{
+    assert(y >= 0 && y < height);
+    return this->px + (size_t)y * width;
+}
+
 
 // Create a transposed version of this image
 template <typename _pixel_type>
@@ -159,6 +198,13 @@ void Image<_pixel_type>::save_ppm(const char *ppm_filename) const
     SavePPM6Image(ppm_filename, *this);
 }
 
+template <typename _pixel_type>
+void Image<_pixel_type>::save_ppm(AsyncFileIO &io,
+    const char *ppm_filename) const
+{
+    SavePPM6Image(io, ppm_filename, *this);
+}
+
 
 
 __BCP_END_NAMESPACE
@@ -12,6 +12,14 @@
 __BCP_BEGIN_NAMESPACE
 
 
+// lazy image expressions, see bcp_expr.hpp
+template <typename _derived> class ImageExpr;
+template <typename _pixel_type> class ImageRef;
+
+// asynchronous file I/O, see bcp_asyncio.hpp
+class AsyncFileIO;
+
+
 // Image class, pixel type of the image should be specified as template parameter.
 template <typename _pixel_type = pixel_RGB>
 class Image
@@ -19,6 +27,10 @@ class Image
 public:
     typedef _pixel_type pixel_type;  // type of pixels
 
+    // rows returned by row(y)
+    typedef pixel_type *row_type;
+    typedef const pixel_type *const_row_type;
+
     // initialize image with specified size
     Image(size_type image_width = 0, size_type image_height = 0);
     Image(const char* ppm_filename);   // initialize with a PPM image file
@@ -27,6 +39,15 @@ public:
 
     const Image<pixel_type> & operator = (const Image<pixel_type> &img);
 
+    // exchange the contents of two images, the pixels are not copied
+    void swap(Image<pixel_type> &img);
+
+    // evaluate a lazy image expression into this image
+    template <typename _expr_type>
+    Image(const ImageExpr<_expr_type> &expr);
+    template <typename _expr_type>
+    const Image<pixel_type> & operator = (const ImageExpr<_expr_type> &expr);
+
 
     // get image metrics
     size_type  get_width(void)  const;
@@ -40,6 +61,15 @@ public:
     pixel_type & operator () (index_type m, index_type n);
     const pixel_type & operator () (index_type m, index_type n) const;
 
+    // the pixel array itself, row by row, for loops which walk through it
+    pixel_type * get_pixels(void);
+    const pixel_type * get_pixels(void) const;
+
+    // pixels of row y, indexed by x, see bcp_planar.hpp for the rows of
+    // planar images
+    row_type row(index_type y);
+    const_row_type row(index_type y) const;
+
 
     // create a transposed version of this image
     Image<pixel_type> transpose(void) const;
@@ -61,6 +91,13 @@ public:
     // save the Image object as a PPM6 image
     void save_ppm(const char *ppm_filename) const;
 
+    // the same, written later through io
+    void save_ppm(AsyncFileIO &io, const char *ppm_filename) const;
+
+    // start a lazy expression on this image, the operations chained after
+    // it are evaluated in one pass when the result is assigned or saved
+    ImageRef<pixel_type> lazy(void) const;
+
 
 protected:
     size_type  width, height;  // size of the image: width x height
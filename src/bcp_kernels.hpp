@@ -0,0 +1,151 @@
+#ifndef __BCP_KERNELS_HEADER__
+#define __BCP_KERNELS_HEADER__
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bcp_base.hpp"
+
+/*
+  Hot pixel loops built for several instruction sets. One binary carries
+  all variants, the best one supported by the CPU it runs on is picked the
+  first time PixelKernels() is called, through CPUID.
+
+  The variant can be capped with the environment variable BCP_ISA (one of
+  generic, sse4.2, avx2 and avx512, anything else means generic),
+  PixelKernels().name tells which one is in use.
+*/
+
+__BCP_BEGIN_NAMESPACE
+
+
+/* Table of kernel entry points of a variant. Monochrome and grayscale pixels
+   are passed as arrays of int, 8-bit gray levels as bytes, RGB pixels as
+   interleaved bytes or as rows of the 3 planes of a planar image, packed
+   monochrome rows as arrays of 64-bit words. */
+struct __pixel_kernels
+{
+    const char *name;
+
+    void (*rgb_to_gray)(const byte *rgb, int *gray, size_type n);
+    void (*rgb_threshold)(const byte *rgb, int *mono, size_type n, int threshold);
+    void (*gray_threshold)(const int *gray, int *mono, size_type n, int threshold);
+    void (*rgb_histogram)(const byte *rgb, size_type n, int *hist);
+    int  (*count_black)(const int *mono, size_type n);
+    void (*transpose32)(const int *src, int *dst,
+                        size_type width, size_type height, size_type dst_stride);
+    void (*pack_black)(const int *mono, uint64_t *bits, size_type n);
+    void (*unpack_black)(const uint64_t *bits, int *mono, size_type n);
+    void (*rgb_to_gray8)(const byte *rgb, byte *gray, size_type n);
+    void (*planar_to_gray8)(const byte *r, const byte *g, const byte *b,
+                            byte *gray, size_type n);
+    void (*gray8_threshold)(const byte *gray, int *mono, size_type n, int threshold);
+    void (*gray8_histogram)(const byte *gray, size_type n, int *hist);
+};
+
+
+/* FMA would change the rounding of the grayscale equation, results have to
+   be the same on every variant. */
+#ifdef __GNUC__
+#pragma GCC push_options
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+// baseline variant, built with whatever the compiler targets by default
+#define __BCP_KERNEL_NS   __kernels_generic
+#define __BCP_KERNEL_NAME "generic"
+#include "bcp_kernels_impl.hpp"
+#undef __BCP_KERNEL_NS
+#undef __BCP_KERNEL_NAME
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define __BCP_KERNEL_DISPATCH
+
+#pragma GCC push_options
+#pragma GCC target ("sse4.2,popcnt")
+#define __BCP_KERNEL_NS   __kernels_sse42
+#define __BCP_KERNEL_NAME "sse4.2"
+#include "bcp_kernels_impl.hpp"
+#undef __BCP_KERNEL_NS
+#undef __BCP_KERNEL_NAME
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target ("avx2,popcnt")
+#define __BCP_KERNEL_NS   __kernels_avx2
+#define __BCP_KERNEL_NAME "avx2"
+#include "bcp_kernels_impl.hpp"
+#undef __BCP_KERNEL_NS
+#undef __BCP_KERNEL_NAME
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target ("avx512f,avx512bw,avx512vl,popcnt")
+#define __BCP_KERNEL_NS   __kernels_avx512
+#define __BCP_KERNEL_NAME "avx512"
+#include "bcp_kernels_impl.hpp"
+#undef __BCP_KERNEL_NS
+#undef __BCP_KERNEL_NAME
+#pragma GCC pop_options
+
+#endif /* x86 */
+
+#ifdef __GNUC__
+#pragma GCC pop_options
+#endif
+
+
+/* Pick the best variant supported by this CPU, not above the one requested
+   by BCP_ISA. An unknown BCP_ISA gets the generic variant, the safe one. */
+inline const __pixel_kernels &__select_pixel_kernels(void)
+{
+#ifdef __BCP_KERNEL_DISPATCH
+    const char *cap = getenv("BCP_ISA");
+    int level = 3;    // 0: generic, 1: sse4.2, 2: avx2, 3: avx512
+
+    if (cap != NULL && *cap != '\0')
+    {
+        if (strcmp(cap, "generic") == 0)       level = 0;
+        else if (strcmp(cap, "sse4.2") == 0)   level = 1;
+        else if (strcmp(cap, "avx2") == 0)     level = 2;
+        else if (strcmp(cap, "avx512") == 0)   level = 3;
+        else {
+            fprintf(stderr, "BCP_ISA=%s is unknown, using the generic "
+                "pixel kernels\n", cap);
+            level = 0;
+        }
+    }
+
+    // every variant but the generic one is built with popcnt
+    __builtin_cpu_init();
+    bool popcnt = __builtin_cpu_supports("popcnt");
+    if (level >= 3 && popcnt && __builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl"))
+    {
+        return __kernels_avx512::kernels();
+    }
+    if (level >= 2 && popcnt && __builtin_cpu_supports("avx2"))
+        return __kernels_avx2::kernels();
+    if (level >= 1 && popcnt && __builtin_cpu_supports("sse4.2"))
+        return __kernels_sse42::kernels();
+#endif
+
+    return __kernels_generic::kernels();
+}
+
+/* Kernels to be used on this machine, selected once at the first call */
+inline const __pixel_kernels &PixelKernels(void)
+{
+    static const __pixel_kernels &k = __select_pixel_kernels();
+    return k;
+}
+
+
+__BCP_END_NAMESPACE
+
+
+#endif /* __BCP_KERNELS_HEADER__ */
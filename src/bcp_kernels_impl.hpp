@@ -0,0 +1,214 @@
+/*
+  Bodies of the pixel kernels. This file is included several times by
+  bcp_kernels.hpp, once for each instruction set we build the kernels for,
+  with __BCP_KERNEL_NS naming the namespace of that variant and the target
+  options of the variant pushed by `#pragma GCC target'. There is no include
+  guard on purpose.
+
+  The loops are written to be auto-vectorized, each variant is the same code
+  compiled for a different instruction set.
+*/
+
+
+namespace __BCP_KERNEL_NS {
+
+
+/* Grayscale value of an interleaved RGB pixel, the same empirical equation
+   as __convert_from_RGB_to(px, pixel_Grayscale()) */
+inline int __gray(const byte *p) {
+    return (int)(p[0] * 0.30 + p[1] * 0.59 + p[2] * 0.11 + 0.5);
+}
+
+// RGB ==> Grayscale
+inline void rgb_to_gray(const byte *rgb, int *gray, size_type n)
+{
+    for (size_type i = 0; i < n; i++) {
+        gray[i] = __gray(rgb + 3 * i);
+    }
+}
+
+// RGB ==> Monochrome, white when the gray value reaches the threshold
+inline void rgb_threshold(
+    const byte *rgb, int *mono, size_type n, int threshold)
+{
+    for (size_type i = 0; i < n; i++) {
+        mono[i] = __gray(rgb + 3 * i) >= threshold? 1: 0;
+    }
+}
+
+// Grayscale ==> Monochrome
+inline void gray_threshold(
+    const int *gray, int *mono, size_type n, int threshold)
+{
+    for (size_type i = 0; i < n; i++) {
+        mono[i] = gray[i] >= threshold? 1: 0;
+    }
+}
+
+/* Accumulate the grayscale histogram of RGB pixels into hist[256]. Gray values
+   are converted in vectorizable chunks first and then counted into 4 separate
+   histograms, so that consecutive increments don't wait for each other. */
+inline void rgb_histogram(const byte *rgb, size_type n, int *hist)
+{
+    const size_type chunk = 256;
+    int gray[chunk];
+    int sub_hist[4][256] = {{0}};
+
+    for (size_type i = 0; i < n; i += chunk)
+    {
+        size_type len = n - i < chunk? n - i: chunk;
+        rgb_to_gray(rgb + 3 * i, gray, len);
+
+        size_type j = 0;
+        for ( ; j + 4 <= len; j += 4) {
+            sub_hist[0][gray[j]]++;     sub_hist[1][gray[j + 1]]++;
+            sub_hist[2][gray[j + 2]]++; sub_hist[3][gray[j + 3]]++;
+        }
+        for ( ; j < len; j++) sub_hist[0][gray[j]]++;
+    }
+
+    for (int v = 0; v < 256; v++) {
+        hist[v] += sub_hist[0][v] + sub_hist[1][v] + sub_hist[2][v] + sub_hist[3][v];
+    }
+}
+
+// Count black (zero) pixels in a run of monochrome pixels
+inline int count_black(const int *mono, size_type n)
+{
+    int n_black = 0;
+    for (size_type i = 0; i < n; i++) {
+        n_black += (mono[i] == 0? 1: 0);
+    }
+    return n_black;
+}
+
+/* Transpose a width x height matrix of 32-bit pixels, tile by tile so that
+   both the rows being read and the columns being written stay in cache.
+   Rows of dst are dst_stride pixels apart. */
+inline void transpose32(
+    const int *src, int *dst, size_type width, size_type height,
+    size_type dst_stride)
+{
+    const size_type tile = 32;
+
+    for (size_type y0 = 0; y0 < height; y0 += tile)
+    {
+        size_type y1 = y0 + tile < height? y0 + tile: height;
+        for (size_type x0 = 0; x0 < width; x0 += tile)
+        {
+            size_type x1 = x0 + tile < width? x0 + tile: width;
+            for (size_type y = y0; y < y1; y++)
+            {
+                for (size_type x = x0; x < x1; x++) {
+                    dst[x * dst_stride + y] = src[y * width + x];
+                }
+            }
+        }
+    }
+}
+
+/* Pack a row of n monochrome pixels 64 a word, bit i of a word is 1 when
+   pixel i is black. The bits past n in the last word are 0. Full words go
+   through bytes of 0 and 1, which are gathered 8 at a time by a multiply:
+   byte i of g lands on bit 56 + i of g * 0x0102040810204080. */
+inline void pack_black(const int *mono, uint64_t *bits, size_type n)
+{
+    size_type x0 = 0;
+    for ( ; x0 + 64 <= n; x0 += 64)
+    {
+        byte black[64];
+        for (int i = 0; i < 64; i++) {
+            black[i] = (byte)(mono[x0 + i] == 0);
+        }
+
+        uint64_t word = 0;
+        for (int j = 0; j < 8; j++) {
+            uint64_t g;
+            memcpy(&g, black + 8 * j, sizeof(g));
+            word |= ((g * 0x0102040810204080ULL) >> 56) << (8 * j);
+        }
+        bits[x0 / 64] = word;
+    }
+
+    if (x0 < n)
+    {
+        uint64_t word = 0;
+        for (size_type i = 0; i < n - x0; i++) {
+            word |= (uint64_t)(mono[x0 + i] == 0) << i;
+        }
+        bits[x0 / 64] = word;
+    }
+}
+
+// Unpack a row packed by pack_black()
+inline void unpack_black(const uint64_t *bits, int *mono, size_type n)
+{
+    for (size_type x0 = 0; x0 < n; x0 += 64)
+    {
+        size_type len = n - x0 < 64? n - x0: 64;
+        uint64_t word = ~bits[x0 / 64];
+        for (size_type i = 0; i < len; i++) {
+            mono[x0 + i] = (int)(word >> i) & 1;
+        }
+    }
+}
+
+// RGB ==> 8-bit grayscale
+inline void rgb_to_gray8(const byte *rgb, byte *gray, size_type n)
+{
+    for (size_type i = 0; i < n; i++) {
+        gray[i] = (byte)__gray(rgb + 3 * i);
+    }
+}
+
+/* Planar RGB ==> 8-bit grayscale, the components of consecutive pixels are
+   loaded a vector at a time from their planes */
+inline void planar_to_gray8(const byte *r, const byte *g, const byte *b,
+    byte *gray, size_type n)
+{
+    for (size_type i = 0; i < n; i++) {
+        gray[i] = (byte)(int)(r[i] * 0.30 + g[i] * 0.59 + b[i] * 0.11 + 0.5);
+    }
+}
+
+// 8-bit grayscale ==> Monochrome
+inline void gray8_threshold(
+    const byte *gray, int *mono, size_type n, int threshold)
+{
+    for (size_type i = 0; i < n; i++) {
+        mono[i] = gray[i] >= threshold? 1: 0;
+    }
+}
+
+// Accumulate the histogram of 8-bit gray levels, 4 at a time like above
+inline void gray8_histogram(const byte *gray, size_type n, int *hist)
+{
+    int sub_hist[4][256] = {{0}};
+
+    size_type i = 0;
+    for ( ; i + 4 <= n; i += 4) {
+        sub_hist[0][gray[i]]++;     sub_hist[1][gray[i + 1]]++;
+        sub_hist[2][gray[i + 2]]++; sub_hist[3][gray[i + 3]]++;
+    }
+    for ( ; i < n; i++) sub_hist[0][gray[i]]++;
+
+    for (int v = 0; v < 256; v++) {
+        hist[v] += sub_hist[0][v] + sub_hist[1][v] + sub_hist[2][v] + sub_hist[3][v];
+    }
+}
+
+/* Kernel table of this variant */
+inline const __pixel_kernels &kernels(void)
+{
+    static const __pixel_kernels k = {
+        __BCP_KERNEL_NAME,
+        rgb_to_gray, rgb_threshold, gray_threshold,
+        rgb_histogram, count_black, transpose32,
+        pack_black, unpack_black,
+        rgb_to_gray8, planar_to_gray8, gray8_threshold, gray8_histogram
+    };
+    return k;
+}
+
+
+}   // namespace __BCP_KERNEL_NS
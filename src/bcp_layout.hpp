@@ -0,0 +1,319 @@
+#ifndef __BCP_LAYOUT_HEADER__
+#define __BCP_LAYOUT_HEADER__
+
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+
+#include "bcp_base.hpp"
+#include "bcp_exception.hpp"
+
+/*
+  Invoice layouts: where the 2D codes are printed on an invoice template.
+  Layouts are described by InvoiceLayout and can be loaded from a layout
+  file, the layout of a document is picked by its page size.
+
+  The layout of our most common template is also available as a type,
+  DefaultInvoiceLayout, whose geometry is made of compile-time constants.
+  Extract2DCodes() runs a specialized instance of the pipeline for it.
+*/
+
+__BCP_BEGIN_NAMESPACE
+
+
+/* When a page is not worth extracting, when to stop the tilt search and
+   where to look for the codes. Ink is the part of the pixels of the target
+   box which come out black after thresholding. */
+struct ExtractionLimits
+{
+    int min_contrast;          // gray levels between the mean of ink and
+                               // the mean of paper, less is a blank page
+    double min_ink, max_ink;   // ink in the target box
+    double min_code_ink;       // ink in the densest band as tall as a code,
+                               // less means there's no row of codes
+    double stop_ink;           // stop the tilt search at the first oblique
+                               // level whose code band has this much ink,
+                               // 0 for the full search
+    int search_margin;         // look for the codes this far around the
+                               // target box and move the box onto them,
+                               // 0 to take the target box as it is
+    int max_line_thickness;    // remove lines as long as a code and at most
+                               // this thick from the thresholded box, 0 to
+                               // keep them
+    int speckle_radius;        // open the thresholded box with a square of
+                               // 2*radius+1 pixels, 0 to keep the speckle
+    double min_part_score;     // crop parts scoring less again, and don't
+                               // pass them on, see ScorePart()
+
+    ExtractionLimits(void)
+        : min_contrast(48), min_ink(0.02), max_ink(0.75),
+          min_code_ink(0.15), stop_ink(0), search_margin(0),
+          max_line_thickness(0), speckle_radius(0), min_part_score(0) {}
+};
+
+
+/* Geometry of an invoice template, in pixels. The codes are printed in a row
+   inside the target box, code_left is the upper bound of the horizontal
+   position of the first code and code_padding is the gap between two
+   adjacent codes. */
+struct InvoiceLayout
+{
+    std::string name;
+    size_type page_width, page_height;   // pages of this template, 0 for any
+    index_type target_x0, target_y0;     // target box, roughly
+    size_type target_width, target_height;
+    size_type code_size, code_left, code_padding;
+    int max_oblique;           // tilt search range passed to Locate2DCode
+    int n_codes;               // number of 2D codes printed on an invoice
+    ExtractionLimits limits;
+
+    // the default layout
+    InvoiceLayout(void);
+
+    // whether the geometry is the same (names and page sizes aside)
+    bool same_geometry(const InvoiceLayout &layout) const {
+        return target_x0 == layout.target_x0 &&
+            target_y0 == layout.target_y0 &&
+            target_width == layout.target_width &&
+            target_height == layout.target_height &&
+            code_size == layout.code_size && code_left == layout.code_left &&
+            code_padding == layout.code_padding &&
+            max_oblique == layout.max_oblique && n_codes == layout.n_codes;
+    }
+};
+
+
+/* Whether the geometry of a layout can be extracted: sizes are positive and
+   the row of codes, from the left bound of the first one, fits the target
+   box. The codes are cropped from the box on these bounds. */
+constexpr bool __LayoutGeometryValid(long target_width, long target_height,
+    long code_size, long code_left, long code_padding, long max_oblique,
+    long n_codes)
+{
+    return target_width > 0 && target_height > 0 &&
+        code_size > 0 && code_size <= target_height &&
+        code_left > 0 && code_padding >= 0 && max_oblique >= 0 &&
+        n_codes > 0 && code_left + n_codes * code_size +
+            (n_codes - 1) * code_padding <= target_width;
+}
+
+
+/* A layout known at compile time. The members have the same names as the
+   ones of InvoiceLayout, so code written against one works with the other. */
+template <index_type _target_x0, index_type _target_y0,
+    size_type _target_width, size_type _target_height,
+    size_type _code_size, size_type _code_left, size_type _code_padding,
+    int _max_oblique, int _n_codes>
+struct StaticInvoiceLayout
+{
+    static constexpr index_type target_x0 = _target_x0;
+    static constexpr index_type target_y0 = _target_y0;
+    static constexpr size_type  target_width  = _target_width;
+    static constexpr size_type  target_height = _target_height;
+    static constexpr size_type  code_size     = _code_size;
+    static constexpr size_type  code_left     = _code_left;
+    static constexpr size_type  code_padding  = _code_padding;
+    static constexpr int max_oblique = _max_oblique;
+    static constexpr int n_codes     = _n_codes;
+
+    static_assert(__LayoutGeometryValid(_target_width, _target_height,
+        _code_size, _code_left, _code_padding, _max_oblique, _n_codes),
+        "the codes of the layout don't fit its target box");
+
+    // the same layout as an InvoiceLayout
+    static InvoiceLayout layout(const char *name = "default")
+    {
+        InvoiceLayout l;
+        l.name = name;
+        l.page_width = l.page_height = 0;
+        l.target_x0 = target_x0, l.target_y0 = target_y0;
+        l.target_width = target_width, l.target_height = target_height;
+        l.code_size = code_size, l.code_left = code_left;
+        l.code_padding = code_padding;
+        l.max_oblique = max_oblique, l.n_codes = n_codes;
+        return l;
+    }
+};
+
+#define __BCP_STATIC_LAYOUT_MEMBER(type, name)                              \
+    template <index_type _x0, index_type _y0, size_type _w, size_type _h,   \
+        size_type _cs, size_type _cl, size_type _cp, int _mo, int _nc>      \
+    constexpr type                                                          \
+    StaticInvoiceLayout<_x0, _y0, _w, _h, _cs, _cl, _cp, _mo, _nc>::name
+
+__BCP_STATIC_LAYOUT_MEMBER(index_type, target_x0);
+__BCP_STATIC_LAYOUT_MEMBER(index_type, target_y0);
+__BCP_STATIC_LAYOUT_MEMBER(size_type,  target_width);
+__BCP_STATIC_LAYOUT_MEMBER(size_type,  target_height);
+__BCP_STATIC_LAYOUT_MEMBER(size_type,  code_size);
+__BCP_STATIC_LAYOUT_MEMBER(size_type,  code_left);
+__BCP_STATIC_LAYOUT_MEMBER(size_type,  code_padding);
+__BCP_STATIC_LAYOUT_MEMBER(int,        max_oblique);
+__BCP_STATIC_LAYOUT_MEMBER(int,        n_codes);
+
+#undef __BCP_STATIC_LAYOUT_MEMBER
+
+
+/* Our highest-volume template */
+typedef StaticInvoiceLayout<
+    1350, 232, 1212, 428,       // target box
+    216, 250, 10,               // code size, left bound and padding
+    50, 4> DefaultInvoiceLayout;
+
+inline InvoiceLayout::InvoiceLayout(void)
+    : name("default"), page_width(0), page_height(0),
+      target_x0(DefaultInvoiceLayout::target_x0),
+      target_y0(DefaultInvoiceLayout::target_y0),
+      target_width(DefaultInvoiceLayout::target_width),
+      target_height(DefaultInvoiceLayout::target_height),
+      code_size(DefaultInvoiceLayout::code_size),
+      code_left(DefaultInvoiceLayout::code_left),
+      code_padding(DefaultInvoiceLayout::code_padding),
+      max_oblique(DefaultInvoiceLayout::max_oblique),
+      n_codes(DefaultInvoiceLayout::n_codes), limits() {}
+
+
+/* Load layouts from a layout file. A layout starts with its name in brackets
+   and is followed by "key = value" lines, keys not given keep the values of
+   the default layout. '#' starts a comment.
+
+       [utility-bill]
+       page   = 2480 3508       # width height, omit for any page size
+       target = 1300 410 1150 400   # x0 y0 width height
+       code_size = 200
+       code_left = 240
+       code_padding = 12
+       max_oblique = 40
+       n_codes = 3
+       min_contrast = 48        # see ExtractionLimits
+       min_ink = 0.02
+       max_ink = 0.75
+       min_code_ink = 0.15
+       stop_ink = 0
+       search_margin = 0
+       max_line_thickness = 0
+       speckle_radius = 0
+       min_part_score = 0
+
+   Throws invalid_layout_file on syntax errors, and at the name of a layout
+   whose codes don't fit its target box (see __LayoutGeometryValid()). */
+inline std::vector<InvoiceLayout> LoadInvoiceLayouts(const char *filename)
+{
+    std::ifstream file(filename);
+    if (!file)
+        throw cannot_open_file(filename);
+
+    std::vector<InvoiceLayout> layouts;
+    std::vector<int> layout_lines;      // where each layout starts
+    std::string line;
+    for (int line_no = 1; std::getline(file, line); line_no++)
+    {
+        line = line.substr(0, line.find('#'));
+        std::string::size_type eq = line.find('=');
+        std::istringstream key_field(line.substr(0, eq));
+        std::string key, rest;
+        if (!(key_field >> key))
+        {
+            if (eq == std::string::npos)
+                continue;       // blank line
+            throw invalid_layout_file(filename, line_no);
+        }
+
+        if (key[0] == '[')
+        {
+            if (key.size() < 3 || key[key.size() - 1] != ']' ||
+                eq != std::string::npos || key_field >> rest)
+                throw invalid_layout_file(filename, line_no);
+            layouts.push_back(InvoiceLayout());
+            layouts.back().name = key.substr(1, key.size() - 2);
+            layout_lines.push_back(line_no);
+            continue;
+        }
+
+        if (layouts.empty() || eq == std::string::npos || key_field >> rest)
+            throw invalid_layout_file(filename, line_no);
+
+        std::istringstream fields(line.substr(eq + 1));
+        InvoiceLayout &l = layouts.back();
+        ExtractionLimits &lim = l.limits;
+        bool ok;
+        if (key == "page")
+            ok = (bool)(fields >> l.page_width >> l.page_height);
+        else if (key == "target")
+            ok = (bool)(fields >> l.target_x0 >> l.target_y0
+                               >> l.target_width >> l.target_height);
+        else if (key == "code_size")    ok = (bool)(fields >> l.code_size);
+        else if (key == "code_left")    ok = (bool)(fields >> l.code_left);
+        else if (key == "code_padding") ok = (bool)(fields >> l.code_padding);
+        else if (key == "max_oblique")  ok = (bool)(fields >> l.max_oblique);
+        else if (key == "n_codes")      ok = (bool)(fields >> l.n_codes);
+        else if (key == "min_contrast") ok = (bool)(fields >> lim.min_contrast);
+        else if (key == "min_ink")      ok = (bool)(fields >> lim.min_ink);
+        else if (key == "max_ink")      ok = (bool)(fields >> lim.max_ink);
+        else if (key == "min_code_ink") ok = (bool)(fields >> lim.min_code_ink);
+        else if (key == "stop_ink")     ok = (bool)(fields >> lim.stop_ink);
+        else if (key == "search_margin")
+            ok = (bool)(fields >> lim.search_margin);
+        else if (key == "max_line_thickness")
+            ok = (bool)(fields >> lim.max_line_thickness);
+        else if (key == "speckle_radius")
+            ok = (bool)(fields >> lim.speckle_radius);
+        else if (key == "min_part_score")
+            ok = (bool)(fields >> lim.min_part_score);
+        else ok = false;
+
+        if (!ok || fields >> rest)
+            throw invalid_layout_file(filename, line_no);
+    }
+
+    for (size_t i = 0; i < layouts.size(); i++)
+    {
+        const InvoiceLayout &l = layouts[i];
+        if (!__LayoutGeometryValid(l.target_width, l.target_height,
+                l.code_size, l.code_left, l.code_padding, l.max_oblique,
+                l.n_codes))
+            throw invalid_layout_file(filename, layout_lines[i]);
+    }
+
+    return layouts;
+}
+
+/* The layout of a page of width x height: the first one made for pages of
+   this size, or else the first one for pages of any size. NULL when there's
+   no such layout. */
+inline const InvoiceLayout *SelectInvoiceLayout(
+    const std::vector<InvoiceLayout> &layouts,
+    size_type width, size_type height)
+{
+    const InvoiceLayout *any_size = NULL;
+    for (size_t i = 0; i < layouts.size(); i++)
+    {
+        const InvoiceLayout &l = layouts[i];
+        if (l.page_width == width && l.page_height == height)
+            return &l;
+        if (l.page_width == 0 && l.page_height == 0 && any_size == NULL)
+            any_size = &l;
+    }
+    return any_size;
+}
+
+/* The layout named `name', NULL when there's no such layout. */
+inline const InvoiceLayout *FindInvoiceLayout(
+    const std::vector<InvoiceLayout> &layouts, const std::string &name)
+{
+    for (size_t i = 0; i < layouts.size(); i++) {
+        if (layouts[i].name == name)
+            return &layouts[i];
+    }
+    return NULL;
+}
+
+
+__BCP_END_NAMESPACE
+
+
+#endif /* __BCP_LAYOUT_HEADER__ */
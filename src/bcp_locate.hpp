@@ -5,6 +5,7 @@
 #include <algorithm>
 #include <functional>
 #include <numeric>
+#include <cmath>
 #include "bcp_proc.hpp"
 
 
@@ -101,19 +102,34 @@ inline __2Dcode_Location __Estimate2DcodeLocation(
 }
 
 
-/* Try tomography projection on different oblique levels and pick up the best 
-   one, we can get the horizonal tilt and vertical location of the 2D code 
-   through this procedure.
-*/
+/* Try tomography projection on the oblique levels [h_begin, h_end) and pick
+   up the best one.
+
+   With stop_confidence > 0, the levels are tried from h_center outwards
+   (h_center, h_center-1, h_center+1, ...) and the search stops at the first
+   level reaching stop_confidence. */
 template <typename _pixel_type>
-__2Dcode_Location Locate2DCode(
-    const Image<_pixel_type> &img, int max_oblique, size_type code_height)
+__2Dcode_Location __Locate2DCodeOnLevels(
+    const Image<_pixel_type> &img, int h_begin, int h_end,
+    size_type code_height, int stop_confidence = 0, int h_center = 0)
 {
     std::vector<int> tomo_array(img.get_height());
     __2Dcode_Location best_so_far = {0, 0, 0};
 
-    for (int h_oblique = -max_oblique; h_oblique < max_oblique; h_oblique++)
+    h_center = std::min(std::max(h_center, h_begin), h_end - 1);
+    for (int i = 0, n_levels = h_end - h_begin, n_tried = 0;
+         n_tried < n_levels; i++)
     {
+        int h_oblique = h_begin + i;
+        if (stop_confidence > 0)
+        {
+            // 0, -1, +1, -2, +2 ... from the center, skip those out of range
+            h_oblique = h_center + (i % 2 == 0? i / 2: -(i + 1) / 2);
+            if (h_oblique < h_begin || h_oblique >= h_end)
+                continue;
+        }
+        n_tried++;
+
         // adjust the sweep angle and make the tomography projection
         double k = (double)h_oblique / (double)img.get_width();
         TomographyProjection(img, k, tomo_array);
@@ -126,11 +142,141 @@ __2Dcode_Location Locate2DCode(
             best_so_far = loc; 
             best_so_far.tilt = k;
         }
+
+        if (stop_confidence > 0 && best_so_far.confidence >= stop_confidence)
+            break;
     }
 
     return best_so_far;
 }
 
+/* Try tomography projection on different oblique levels and pick up the best 
+   one, we can get the horizonal tilt and vertical location of the 2D code 
+   through this procedure.
+*/
+template <typename _pixel_type>
+__2Dcode_Location Locate2DCode(
+    const Image<_pixel_type> &img, int max_oblique, size_type code_height)
+{
+    return __Locate2DCodeOnLevels(img, -max_oblique, max_oblique, code_height);
+}
+
+/* Locate2DCode() stopping as soon as an oblique level reaches the given
+   confidence, levels of little tilt are tried first. */
+template <typename _pixel_type>
+__2Dcode_Location Locate2DCode(
+    const Image<_pixel_type> &img, int max_oblique, size_type code_height,
+    int stop_confidence)
+{
+    return __Locate2DCodeOnLevels(
+        img, -max_oblique, max_oblique, code_height, stop_confidence, 0);
+}
+
+
+/* What we know about the pages of a source (a scanner feeder, a batch...)
+   so far. Pages of the same source are skewed about the same way, so the
+   search for the tilt of a page can start from the tilt of the previous one.
+
+   The prior learns the usual confidence of the pages, a search around the
+   previous tilt whose result is much less confident than usual is redone
+   with the full sweep. */
+class LocationPrior
+{
+public:
+    /* window: oblique levels tried on each side of the previous tilt,
+       min_ratio: part of the usual confidence a result needs to be kept */
+    LocationPrior(int window_levels = 3, double confidence_ratio = 0.9)
+        : window(window_levels), min_ratio(confidence_ratio) {
+        reset();
+    }
+
+    // forget everything, the next page gets the full sweep
+    void reset(void) {
+        n_pages = 0, n_warm = 0;
+        last.y0 = 0, last.tilt = 0, last.confidence = 0;
+        usual_confidence = 0;
+    }
+
+    bool valid(void) const {
+        return n_pages > 0;
+    }
+
+    // location of the previous page
+    const __2Dcode_Location &previous(void) const {
+        return last;
+    }
+
+    // confidence a result of the warm-started search needs to be kept
+    int min_confidence(void) const {
+        return (int)(usual_confidence * min_ratio);
+    }
+
+    // record the location of a page
+    void update(const __2Dcode_Location &loc, bool warm)
+    {
+        // usual confidence: moving average over the last ten pages or so
+        usual_confidence = n_pages == 0? loc.confidence:
+            usual_confidence * 0.9 + loc.confidence * 0.1;
+        last = loc;
+        n_pages++;
+        n_warm += warm? 1: 0;
+    }
+
+    int window;
+    double min_ratio;
+
+    int n_pages;        // pages located so far
+    int n_warm;         // ... of which without the full sweep
+
+private:
+    __2Dcode_Location last;
+    double usual_confidence;
+};
+
+/* Locate2DCode() for a page of the source described by `prior': only the
+   oblique levels next to the tilt of the previous page are tried. The full
+   sweep is done anyway when the result is not confident enough, or when the
+   best level is on the edge of the window, since the tilt may have drifted
+   further. The prior is updated with the result.
+*/
+template <typename _pixel_type>
+__2Dcode_Location Locate2DCode(
+    const Image<_pixel_type> &img, int max_oblique, size_type code_height,
+    LocationPrior &prior, int stop_confidence = 0)
+{
+    if (prior.valid())
+    {
+        int h_prev = (int)std::floor(
+            prior.previous().tilt * img.get_width() + 0.5);
+        int h_begin = std::max(h_prev - prior.window, -max_oblique);
+        int h_end   = std::min(h_prev + prior.window + 1, max_oblique);
+
+        if (h_begin < h_end)
+        {
+            __2Dcode_Location loc = __Locate2DCodeOnLevels(
+                img, h_begin, h_end, code_height, stop_confidence, h_prev);
+            int h_best = (int)std::floor(loc.tilt * img.get_width() + 0.5);
+            bool stopped = stop_confidence > 0 &&
+                loc.confidence >= stop_confidence;
+            bool on_edge = !stopped && (
+                (h_best == h_begin && h_begin > -max_oblique) ||
+                (h_best == h_end - 1 && h_end < max_oblique));
+
+            if (!on_edge && loc.confidence > 0 &&
+                loc.confidence >= prior.min_confidence())
+            {
+                prior.update(loc, true);
+                return loc;
+            }
+        }
+    }
+
+    __2Dcode_Location loc = __Locate2DCodeOnLevels(img,
+        -max_oblique, max_oblique, code_height, stop_confidence, 0);
+    prior.update(loc, false);
+    return loc;
+}
+
 __BCP_END_NAMESPACE
 
 
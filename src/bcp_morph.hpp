@@ -0,0 +1,353 @@
+#ifndef __BCP_MORPHOLOGY_HEADER__
+#define __BCP_MORPHOLOGY_HEADER__
+
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+#include "bcp_image.hpp"
+
+/*
+  Morphology on monochrome images: erosion, dilation, opening, closing and
+  the removal of thin lines, to clean box borders and speckle off the codes.
+  Black pixels (ink) are the foreground: eroding shrinks the ink, dilating
+  grows it. The structuring elements are rectangles, pixels outside the
+  image don't count, so ink touching the border of the image is kept.
+
+  The images are packed 64 pixels a word first, each operation is then a
+  few shifts, ANDs and ORs per word: runs of n pixels are combined in
+  log2(n) steps, by doubling the length of the runs already combined.
+*/
+
+__BCP_BEGIN_NAMESPACE
+
+
+/* A monochrome image packed 64 pixels a word, bit x % 64 of the word x / 64
+   of a row is 1 for a black pixel. The bits past the width are kept 0. */
+struct __bit_plane
+{
+    size_type width, height;
+    size_type n_words;             // words of a row
+    std::vector<uint64_t> bits;
+
+    __bit_plane(size_type plane_width, size_type plane_height)
+        : width(plane_width), height(plane_height),
+          n_words((plane_width + 63) / 64),
+          bits((size_t)n_words * plane_height, 0) {}
+
+    uint64_t *row(index_type y) {
+        return &bits[(size_t)y * n_words];
+    }
+    const uint64_t *row(index_type y) const {
+        return &bits[(size_t)y * n_words];
+    }
+
+    // bits of the last word of a row which are pixels
+    uint64_t tail_mask(void) const {
+        return width % 64 == 0? ~(uint64_t)0: ((uint64_t)1 << (width % 64)) - 1;
+    }
+};
+
+// pack and unpack a row at a time with the pixel kernels
+inline __bit_plane __PackMonochrome(const Image<pixel_Monochrome> &img)
+{
+    __bit_plane plane(img.get_width(), img.get_height());
+    size_type width = img.get_width();
+
+    for (index_type y = 0; y < img.get_height(); y++) {
+        PixelKernels().pack_black(
+            (const int*)(img.get_pixels() + (size_t)y * width),
+            plane.row(y), width);
+    }
+    return plane;
+}
+
+inline Image<pixel_Monochrome> __UnpackMonochrome(const __bit_plane &plane)
+{
+    Image<pixel_Monochrome> img(plane.width, plane.height);
+
+    for (index_type y = 0; y < plane.height; y++) {
+        PixelKernels().unpack_black(plane.row(y),
+            (int*)(img.get_pixels() + (size_t)y * plane.width), plane.width);
+    }
+    return img;
+}
+
+
+/* Erosion combines the pixels of a run with AND, pixels outside the image
+   count as black. Dilation combines them with OR, they count as white. */
+struct __erode_op
+{
+    static uint64_t outside(void) { return ~(uint64_t)0; }
+    static uint64_t combine(uint64_t a, uint64_t b) { return a & b; }
+};
+
+struct __dilate_op
+{
+    static uint64_t outside(void) { return 0; }
+    static uint64_t combine(uint64_t a, uint64_t b) { return a | b; }
+};
+
+// erosion where pixels outside count as white: runs have to be in the image
+struct __erode_in_image_op
+{
+    static uint64_t outside(void) { return 0; }
+    static uint64_t combine(uint64_t a, uint64_t b) { return a & b; }
+};
+
+/* dst[x] = src[x + k] for each pixel x of a row of n_words words, k may be
+   negative as long as src has words enough before it */
+inline void __shift_row(const uint64_t *src, size_type n_words, int k,
+    uint64_t *dst)
+{
+    int q = k >> 6, s = k & 63;      // floor(k / 64) and the rest
+    const uint64_t *p = src + q;
+
+    if (s == 0) {
+        std::copy(p, p + n_words, dst);
+        return;
+    }
+    for (index_type w = 0; w < n_words; w++) {
+        dst[w] = (p[w] >> s) | (p[w + 1] << (64 - s));
+    }
+}
+
+/* Combine the runs of n pixels of each row: pixel x of the result is the
+   combination of the pixels [x - offset, x - offset + n) of the plane.
+
+   A row is copied in a buffer with `offset' pixels of outside value before
+   it and n after it, and the runs are combined over the buffer: runs which
+   start before the row are needed as well. */
+template <typename _op>
+void __CombineRunsH(__bit_plane &plane, int n, int offset)
+{
+    if (plane.width == 0 || plane.height == 0)
+        return;
+
+    const size_type n_words = plane.n_words;
+    const uint64_t tail = plane.tail_mask();
+    const int before = (offset + 63) / 64 + 1, after = (n + 63) / 64 + 1;
+    const size_type n_runs = before + n_words;   // words of runs computed
+
+    std::vector<uint64_t> buf(before + n_words + after);
+    for (index_type y = 0; y < plane.height; y++)
+    {
+        uint64_t *row = plane.row(y);
+        std::fill(buf.begin(), buf.end(), _op::outside());
+        std::copy(row, row + n_words, &buf[before]);
+        buf[before + n_words - 1] =
+            (row[n_words - 1] & tail) | (_op::outside() & ~tail);
+
+        // buf[x] = combination of [x, x + covered), in place from the left
+        for (int covered = 1; covered < n; )
+        {
+            int step = std::min(covered, n - covered);
+            int q = step >> 6, s = step & 63;
+            for (index_type w = 0; w < n_runs; w++)
+            {
+                uint64_t next = s == 0? buf[w + q]:
+                    (buf[w + q] >> s) | (buf[w + q + 1] << (64 - s));
+                buf[w] = _op::combine(buf[w], next);
+            }
+            covered += step;
+        }
+
+        __shift_row(&buf[before], n_words, -offset, row);
+        row[n_words - 1] &= tail;
+    }
+}
+
+/* The same on the columns: pixel y of the result is the combination of the
+   pixels [y - offset, y - offset + n) of the column, pixels above and below
+   the plane have the outside value */
+template <typename _op>
+void __CombineRunsV(__bit_plane &plane, int n, int offset)
+{
+    if (plane.width == 0 || plane.height == 0)
+        return;
+
+    const size_type n_words = plane.n_words;
+    const uint64_t tail = plane.tail_mask();
+    const int after = std::max(n - 1 - offset, 0);
+    const index_type n_rows = offset + plane.height + after;
+
+    /* the plane between `offset' rows of outside value above it and the
+       rows the runs of its last row reach below it */
+    std::vector<uint64_t> buf((size_t)n_rows * n_words, _op::outside());
+    std::copy(plane.bits.begin(), plane.bits.end(),
+        buf.begin() + (size_t)offset * n_words);
+
+    // row y = combination of [y, y + covered), in place from the top
+    for (int covered = 1; covered < n; )
+    {
+        int step = std::min(covered, n - covered);
+        for (index_type y = 0; y + step < n_rows; y++)
+        {
+            uint64_t *row = &buf[(size_t)y * n_words];
+            const uint64_t *next = row + (size_t)step * n_words;
+            for (index_type w = 0; w < n_words; w++) {
+                row[w] = _op::combine(row[w], next[w]);
+            }
+        }
+        covered += step;
+    }
+
+    std::copy(buf.begin(), buf.begin() + plane.bits.size(),
+        plane.bits.begin());
+    for (index_type y = 0; y < plane.height; y++) {
+        plane.row(y)[n_words - 1] &= tail;
+    }
+}
+
+// erode or dilate with a (2rx+1) x (2ry+1) rectangle centered on the pixel
+template <typename _op>
+void __Morph(__bit_plane &plane, int rx, int ry)
+{
+    if (rx > 0) __CombineRunsH<_op>(plane, 2 * rx + 1, rx);
+    if (ry > 0) __CombineRunsV<_op>(plane, 2 * ry + 1, ry);
+}
+
+/* Opening and closing with a length_x x length_y rectangle, the erosion and
+   dilation of __Morph() for even lengths too: the ink left by an opening is
+   the union of the rectangles which fit in the ink. Erosion and dilation by
+   a rectangle are done a direction after the other. */
+template <typename _erode_op = __erode_op>
+void __Open(__bit_plane &plane, int length_x, int length_y)
+{
+    int cx = length_x / 2, cy = length_y / 2;
+    if (length_x > 1) __CombineRunsH<_erode_op>(plane, length_x, cx);
+    if (length_y > 1) __CombineRunsV<_erode_op>(plane, length_y, cy);
+    if (length_x > 1)
+        __CombineRunsH<__dilate_op>(plane, length_x, length_x - 1 - cx);
+    if (length_y > 1)
+        __CombineRunsV<__dilate_op>(plane, length_y, length_y - 1 - cy);
+}
+
+inline void __Close(__bit_plane &plane, int length_x, int length_y)
+{
+    int cx = length_x / 2, cy = length_y / 2;
+    if (length_x > 1) __CombineRunsH<__dilate_op>(plane, length_x, cx);
+    if (length_y > 1) __CombineRunsV<__dilate_op>(plane, length_y, cy);
+    if (length_x > 1)
+        __CombineRunsH<__erode_op>(plane, length_x, length_x - 1 - cx);
+    if (length_y > 1)
+        __CombineRunsV<__erode_op>(plane, length_y, length_y - 1 - cy);
+}
+
+/* Thin lines of a plane: ink in horizontal or vertical runs of at least
+   min_length pixels, where the ink is at most max_thickness pixels thick
+   across the run */
+inline __bit_plane __ThinLines(const __bit_plane &plane,
+    int min_length, int max_thickness)
+{
+    __bit_plane lines(plane.width, plane.height);
+
+    for (int vertical = 0; vertical < 2; vertical++)
+    {
+        // the runs, and the parts of them thicker than max_thickness
+        __bit_plane runs = plane, thick(0, 0);
+        if (!vertical) {
+            __Open<__erode_in_image_op>(runs, min_length, 1);
+            thick = runs;
+            __Open<__erode_in_image_op>(thick, 1, max_thickness + 1);
+        }
+        else {
+            __Open<__erode_in_image_op>(runs, 1, min_length);
+            thick = runs;
+            __Open<__erode_in_image_op>(thick, max_thickness + 1, 1);
+        }
+
+        for (size_t i = 0; i < lines.bits.size(); i++) {
+            lines.bits[i] |= runs.bits[i] & ~thick.bits[i];
+        }
+    }
+    return lines;
+}
+
+
+/* Erode the ink of img with a (2*radius_x+1) x (2*radius_y+1) rectangle:
+   a pixel stays black when the whole rectangle around it is black */
+inline Image<pixel_Monochrome> ErodeImage(
+    const Image<pixel_Monochrome> &img, int radius_x, int radius_y)
+{
+    __bit_plane plane = __PackMonochrome(img);
+    __Morph<__erode_op>(plane, radius_x, radius_y);
+    return __UnpackMonochrome(plane);
+}
+
+/* Dilate the ink of img: a pixel becomes black when any pixel of the
+   rectangle around it is black */
+inline Image<pixel_Monochrome> DilateImage(
+    const Image<pixel_Monochrome> &img, int radius_x, int radius_y)
+{
+    __bit_plane plane = __PackMonochrome(img);
+    __Morph<__dilate_op>(plane, radius_x, radius_y);
+    return __UnpackMonochrome(plane);
+}
+
+/* Opening: erosion then dilation, removes the specks of ink smaller than
+   the rectangle and keeps the rest as it is */
+inline Image<pixel_Monochrome> OpenImage(
+    const Image<pixel_Monochrome> &img, int radius_x, int radius_y)
+{
+    __bit_plane plane = __PackMonochrome(img);
+    __Open(plane, 2 * radius_x + 1, 2 * radius_y + 1);
+    return __UnpackMonochrome(plane);
+}
+
+/* Closing: dilation then erosion, fills the holes of the ink smaller than
+   the rectangle */
+inline Image<pixel_Monochrome> CloseImage(
+    const Image<pixel_Monochrome> &img, int radius_x, int radius_y)
+{
+    __bit_plane plane = __PackMonochrome(img);
+    __Close(plane, 2 * radius_x + 1, 2 * radius_y + 1);
+    return __UnpackMonochrome(plane);
+}
+
+/* Remove horizontal and vertical lines of ink at least min_length pixels
+   long and at most max_thickness pixels thick, such as the borders of a
+   box. Ink thicker than that, codes included, is kept where a line runs
+   into it. */
+inline Image<pixel_Monochrome> RemoveThinLines(
+    const Image<pixel_Monochrome> &img, int min_length, int max_thickness)
+{
+    __bit_plane plane = __PackMonochrome(img);
+    __bit_plane lines = __ThinLines(plane, min_length, max_thickness);
+    for (size_t i = 0; i < plane.bits.size(); i++) {
+        plane.bits[i] &= ~lines.bits[i];
+    }
+    return __UnpackMonochrome(plane);
+}
+
+/* Clean a thresholded image before locating the codes, or a split code:
+   remove the thin lines if max_line_thickness > 0, then the specks smaller
+   than a (2*speckle_radius+1) square if speckle_radius > 0. The image is
+   packed once for both. */
+inline void CleanMonochrome(Image<pixel_Monochrome> &img,
+    int min_line_length, int max_line_thickness, int speckle_radius)
+{
+    if (max_line_thickness <= 0 && speckle_radius <= 0)
+        return;
+
+    __bit_plane plane = __PackMonochrome(img);
+    if (max_line_thickness > 0)
+    {
+        __bit_plane lines =
+            __ThinLines(plane, min_line_length, max_line_thickness);
+        for (size_t i = 0; i < plane.bits.size(); i++) {
+            plane.bits[i] &= ~lines.bits[i];
+        }
+    }
+    if (speckle_radius > 0)
+        __Open(plane, 2 * speckle_radius + 1, 2 * speckle_radius + 1);
+
+    img = __UnpackMonochrome(plane);
+}
+
+
+__BCP_END_NAMESPACE
+
+
+#endif /* __BCP_MORPHOLOGY_HEADER__ */
@@ -0,0 +1,415 @@
+#ifndef __BCP_PACK_HEADER__
+#define __BCP_PACK_HEADER__
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+#include "bcp_image.hpp"
+#include "bcp_extract.hpp"
+#include "bcp_exception.hpp"
+
+/*
+  Packed output container: the results of many documents in a single
+  append-only file, instead of a PPM file per part.
+
+  The file starts with the magic "BCPK" and a version, then holds one record
+  per document, each record written with a single write(2):
+
+      u32 magic "BCPR"          u32 record size, this header included
+      u32 status                u32 reject reason
+      f64 tilt                  i32 y0, left, confidence
+      u32 number of parts       u32 length of the document id
+      document id, padded to 4 bytes
+      index: for each part      u32 part index, width, height
+                                u64 offset of the bitmap from the record
+      bitmaps
+
+  Part 0 is the thresholded target box, parts 1..n are the 2D codes. Bitmaps
+  are packed 8 pixels a byte, most significant bit first, with 1 for black
+  and rows padded to a byte, the same as the raster of a PBM (P4) image.
+  Numbers are little endian.
+*/
+
+__BCP_BEGIN_NAMESPACE
+
+
+const char __pack_magic[4]   = {'B', 'C', 'P', 'K'};
+const char __record_magic[4] = {'B', 'C', 'P', 'R'};
+const uint32_t __pack_version = 1;
+
+const size_t __pack_header_size = 8;     // magic and version
+const size_t __record_header_size = 44;  // up to the document id
+const size_t __part_entry_size = 20;
+
+
+// little endian encoding of the numbers in a pack
+inline void __put_u32(std::vector<byte> &buf, uint32_t v) {
+    for (int i = 0; i < 4; i++) buf.push_back((byte)(v >> (8 * i)));
+}
+
+inline void __put_u64(std::vector<byte> &buf, uint64_t v) {
+    for (int i = 0; i < 8; i++) buf.push_back((byte)(v >> (8 * i)));
+}
+
+inline void __put_f64(std::vector<byte> &buf, double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    __put_u64(buf, bits);
+}
+
+inline uint32_t __get_u32(const byte *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+        ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inline uint64_t __get_u64(const byte *p) {
+    return (uint64_t)__get_u32(p) | ((uint64_t)__get_u32(p + 4) << 32);
+}
+
+inline double __get_f64(const byte *p) {
+    uint64_t bits = __get_u64(p);
+    double v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+// bytes of a packed row of `width' pixels
+inline size_t __packed_stride(size_type width) {
+    return ((size_t)width + 7) / 8;
+}
+
+/* Append the bitmap of a monochrome image to buf */
+inline void __pack_bitmap(
+    std::vector<byte> &buf, const Image<pixel_Monochrome> &img)
+{
+    size_t stride = __packed_stride(img.get_width());
+    size_t base = buf.size();
+    buf.resize(base + stride * img.get_height(), 0);
+
+    const pixel_Monochrome *px = img.get_pixels();
+    for (index_type y = 0; y < img.get_height(); y++)
+    {
+        byte *row = &buf[base + stride * y];
+        for (index_type x = 0; x < img.get_width(); x++) {
+            if (px[x].val == 0)
+                row[x >> 3] |= (byte)(0x80 >> (x & 7));
+        }
+        px += img.get_width();
+    }
+}
+
+
+/* Append the record of a document to buf, see above */
+inline void __pack_record(std::vector<byte> &buf, const std::string &doc_id,
+    const __2Dcode_Extraction &ext)
+{
+    std::vector<const Image<pixel_Monochrome> *> parts;
+    if (ext.ok())
+    {
+        parts.push_back(&ext.thresholded);
+        for (size_t i = 0; i < ext.parts.size(); i++)
+            parts.push_back(&ext.parts[i]);
+    }
+
+    size_t record = buf.size();
+    size_t id_size = (doc_id.size() + 3) & ~(size_t)3;
+    size_t offset = __record_header_size + id_size +
+        __part_entry_size * parts.size();
+
+    buf.insert(buf.end(), __record_magic, __record_magic + 4);
+    __put_u32(buf, 0);                    // record size, see below
+    __put_u32(buf, (uint32_t)ext.status);
+    __put_u32(buf, (uint32_t)ext.reason);
+    __put_f64(buf, ext.loc.tilt);
+    __put_u32(buf, (uint32_t)ext.loc.y0);
+    __put_u32(buf, (uint32_t)ext.left);
+    __put_u32(buf, (uint32_t)ext.loc.confidence);
+    __put_u32(buf, (uint32_t)parts.size());
+    __put_u32(buf, (uint32_t)doc_id.size());
+    buf.insert(buf.end(), doc_id.begin(), doc_id.end());
+    buf.resize(record + __record_header_size + id_size, 0);
+
+    // the index
+    for (size_t i = 0; i < parts.size(); i++)
+    {
+        __put_u32(buf, (uint32_t)i);
+        __put_u32(buf, (uint32_t)parts[i]->get_width());
+        __put_u32(buf, (uint32_t)parts[i]->get_height());
+        __put_u64(buf, (uint64_t)offset);
+        offset += __packed_stride(parts[i]->get_width()) *
+            parts[i]->get_height();
+    }
+
+    // the bitmaps
+    for (size_t i = 0; i < parts.size(); i++)
+        __pack_bitmap(buf, *parts[i]);
+
+    uint32_t record_size = (uint32_t)(buf.size() - record);
+    for (int i = 0; i < 4; i++)
+        buf[record + 4 + i] = (byte)(record_size >> (8 * i));
+}
+
+/* Appends documents to a packed output file. Records are written with a
+   single write each to a file opened with O_APPEND, under flock() so that
+   only the first writer of a new file writes its header: several processes
+   may append to the same file. */
+class PackWriter
+{
+public:
+    PackWriter(const char *filename)
+        : fd(open(filename, O_WRONLY | O_CREAT | O_APPEND, 0644)), name(filename)
+    {
+        if (fd < 0)
+            throw cannot_open_file(filename);
+    }
+
+    ~PackWriter(void) {
+        close(fd);
+    }
+
+    // append the results of a document
+    void append(const std::string &doc_id, const __2Dcode_Extraction &ext)
+    {
+        std::vector<byte> record;
+        __pack_record(record, doc_id, ext);
+
+        // a new file gets the header of the pack in the same write
+        __lock lock(fd);
+        std::vector<byte> buf;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size == 0)
+        {
+            buf.insert(buf.end(), __pack_magic, __pack_magic + 4);
+            __put_u32(buf, __pack_version);
+        }
+        buf.insert(buf.end(), record.begin(), record.end());
+
+        write_all(&buf[0], buf.size());
+    }
+
+private:
+    PackWriter(const PackWriter &);
+    const PackWriter & operator = (const PackWriter &);
+
+    // flock() of the file for the scope
+    struct __lock
+    {
+        int fd;
+        __lock(int file_fd): fd(file_fd) {
+            while (flock(fd, LOCK_EX) != 0 && errno == EINTR) {}
+        }
+        ~__lock(void) {
+            flock(fd, LOCK_UN);
+        }
+    };
+
+    void write_all(const byte *data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t n = write(fd, data, size);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                throw cannot_write_file(name.c_str());
+            data += n, size -= (size_t)n;
+        }
+    }
+
+    int fd;
+    std::string name;
+};
+
+
+/* A bitmap in a pack, pointing right into the mapped file */
+struct PackedBitmap
+{
+    size_type width, height;
+    size_t stride;             // bytes of a row
+    const byte *bits;
+
+    // whether the pixel (x, y) is black
+    bool black(index_type x, index_type y) const {
+        return (bits[stride * y + (x >> 3)] & (0x80 >> (x & 7))) != 0;
+    }
+
+    // unpack it into a monochrome image
+    Image<pixel_Monochrome> unpack(void) const
+    {
+        Image<pixel_Monochrome> img(width, height);
+        for (index_type y = 0; y < height; y++)
+        {
+            for (index_type x = 0; x < width; x++) {
+                img(x,y).val = black(x, y)? 0: 1;
+            }
+        }
+        return img;
+    }
+};
+
+/* A document in a pack */
+struct PackedDocument
+{
+    std::string id;
+    ExtractionStatus status;
+    RejectReason reason;
+    double tilt;
+    index_type y0, left;
+    int confidence;
+    std::vector<PackedBitmap> parts;   // thresholded target box, then codes
+};
+
+
+/* Parse the record at rec, with `size' bytes left in the pack, into doc. The
+   bitmaps of doc point into the record. Returns the size of the record. */
+inline size_t __unpack_record(const byte *rec, size_t size, PackedDocument &doc)
+{
+    if (size < __record_header_size || memcmp(rec, __record_magic, 4) != 0)
+        throw invalid_pack_file();
+
+    size_t rec_size = __get_u32(rec + 4);
+    size_t n_parts = __get_u32(rec + 36), id_size = __get_u32(rec + 40);
+    size_t entries = __record_header_size + ((id_size + 3) & ~(size_t)3);
+    if (rec_size > size || entries + __part_entry_size * n_parts > rec_size)
+        throw invalid_pack_file();
+
+    doc.status     = (ExtractionStatus)__get_u32(rec + 8);
+    doc.reason     = (RejectReason)__get_u32(rec + 12);
+    doc.tilt       = __get_f64(rec + 16);
+    doc.y0         = (index_type)__get_u32(rec + 24);
+    doc.left       = (index_type)__get_u32(rec + 28);
+    doc.confidence = (int)__get_u32(rec + 32);
+    if ((unsigned)doc.status > (unsigned)EXTRACTION_REJECTED ||
+        (unsigned)doc.reason >= (unsigned)REJECT_REASON_COUNT)
+        throw invalid_pack_file();
+    doc.id.assign((const char *)rec + __record_header_size, id_size);
+
+    doc.parts.clear();
+    for (size_t i = 0; i < n_parts; i++)
+    {
+        const byte *entry = rec + entries + __part_entry_size * i;
+        uint32_t width = __get_u32(entry + 4), height = __get_u32(entry + 8);
+        if (width > INT_MAX || height > INT_MAX)
+            throw invalid_pack_file();
+
+        PackedBitmap part;
+        part.width  = (size_type)width;
+        part.height = (size_type)height;
+        part.stride = __packed_stride(part.width);
+
+        // the bitmap is in the record, stride * height can't overflow here
+        uint64_t offset = __get_u64(entry + 12);
+        if (offset > rec_size || (height > 0 &&
+                part.stride > (rec_size - offset) / height))
+            throw invalid_pack_file();
+        part.bits = rec + offset;
+        doc.parts.push_back(part);
+    }
+    return rec_size;
+}
+
+
+/* Reads a packed output file through a memory mapping. The documents are
+   indexed when the file is opened, their bitmaps are read from the mapping
+   when they're used. */
+class PackReader
+{
+public:
+    PackReader(const char *filename): data(NULL), size(0)
+    {
+        int fd = open(filename, O_RDONLY);
+        if (fd < 0)
+            throw cannot_open_file(filename);
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw cannot_open_file(filename);
+        }
+        size = (size_t)st.st_size;
+
+        if (size > 0)
+        {
+            void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if (map == MAP_FAILED)
+                throw cannot_open_file(filename);
+            data = (const byte *)map;
+        }
+        else
+            close(fd);
+
+        try {
+            index();
+        }
+        catch (...) {
+            if (data != NULL) munmap((void *)data, size);
+            throw;
+        }
+    }
+
+    ~PackReader(void) {
+        if (data != NULL) munmap((void *)data, size);
+    }
+
+    size_t n_documents(void) const {
+        return documents.size();
+    }
+
+    const PackedDocument &document(size_t i) const {
+        return documents[i];
+    }
+
+    // the document of the given id, NULL when there's no such document
+    const PackedDocument *find(const std::string &id) const
+    {
+        for (size_t i = 0; i < documents.size(); i++) {
+            if (documents[i].id == id)
+                return &documents[i];
+        }
+        return NULL;
+    }
+
+private:
+    PackReader(const PackReader &);
+    const PackReader & operator = (const PackReader &);
+
+    // parse the record headers and indexes
+    void index(void)
+    {
+        if (size == 0)
+            return;
+        if (size < __pack_header_size || memcmp(data, __pack_magic, 4) != 0 ||
+            __get_u32(data + 4) != __pack_version)
+            throw invalid_pack_file();
+
+        for (size_t pos = __pack_header_size; pos < size; )
+        {
+            PackedDocument doc;
+            pos += __unpack_record(data + pos, size - pos, doc);
+            documents.push_back(doc);
+        }
+    }
+
+    const byte *data;
+    size_t size;
+    std::vector<PackedDocument> documents;
+};
+
+
+__BCP_END_NAMESPACE
+
+
+#endif /* __BCP_PACK_HEADER__ */
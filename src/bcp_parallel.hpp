@@ -0,0 +1,265 @@
+#ifndef __BCP_PARALLEL_HEADER__
+#define __BCP_PARALLEL_HEADER__
+
+
+#include <stddef.h>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "bcp_base.hpp"
+
+/*
+  Execution policies for the whole-image operations in bcp_proc.hpp. An image
+  is split into bands of rows which fit in the cache, and the bands are
+  handed to the policy, which runs them serially, on a pool of threads or
+  with OpenMP. Images too small to be worth splitting are always processed
+  serially on the calling thread.
+*/
+
+__BCP_BEGIN_NAMESPACE
+
+
+/* Interface of execution policies: run task(0) ... task(n_tasks-1), in any
+   order and possibly at the same time, and return when all of them are
+   done. */
+class ExecutionPolicy
+{
+public:
+    virtual ~ExecutionPolicy(void) {}
+
+    // number of tasks which can make progress at the same time
+    virtual int concurrency(void) const = 0;
+
+    virtual void run(int n_tasks, const std::function<void(int)> &task) const = 0;
+};
+
+
+/* Everything on the calling thread, this is the default of all operations */
+class SerialExecution: public ExecutionPolicy
+{
+public:
+    int concurrency(void) const {
+        return 1;
+    }
+
+    void run(int n_tasks, const std::function<void(int)> &task) const {
+        for (int i = 0; i < n_tasks; i++) task(i);
+    }
+};
+
+inline const ExecutionPolicy &SerialPolicy(void)
+{
+    static const SerialExecution serial;
+    return serial;
+}
+
+
+/* A pool of worker threads. The calling thread takes part in the work too,
+   so a pool of n threads keeps n-1 workers. Tasks are picked up one by one
+   from a shared counter. */
+class ThreadPoolExecution: public ExecutionPolicy
+{
+public:
+    // n_threads <= 0 stands for the number of hardware threads
+    ThreadPoolExecution(int n_threads = 0)
+        : task(NULL), n_tasks(0), next_task(0), n_done(0), n_active(0),
+          generation(0), stopping(false)
+    {
+        if (n_threads <= 0)
+            n_threads = (int)std::thread::hardware_concurrency();
+        if (n_threads <= 0)
+            n_threads = 1;
+
+        for (int i = 1; i < n_threads; i++)
+            workers.push_back(std::thread(&ThreadPoolExecution::work, this));
+    }
+
+    ~ThreadPoolExecution(void)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+    }
+
+    int concurrency(void) const {
+        return (int)workers.size() + 1;
+    }
+
+    void run(int n, const std::function<void(int)> &fn) const
+    {
+        /* one job at a time, a job started while another one is running
+           (from a task of it, or from another thread) is run serially */
+        std::unique_lock<std::mutex> busy(run_mtx, std::try_to_lock);
+        if (!busy.owns_lock() || workers.empty() || n <= 1) {
+            SerialPolicy().run(n, fn);
+            return;
+        }
+
+        {
+            // a late worker may still be looking at the previous job
+            std::unique_lock<std::mutex> lock(mtx);
+            done.wait(lock, [this] { return n_active == 0; });
+
+            task = &fn;
+            n_tasks = n;
+            next_task = 0;
+            n_done = 0;
+            generation++;
+        }
+        wake.notify_all();
+
+        take_tasks();
+
+        // wait for the tasks, and for the workers to let go of this job
+        std::unique_lock<std::mutex> lock(mtx);
+        done.wait(lock, [this] { return n_done == n_tasks && n_active == 0; });
+        task = NULL;
+    }
+
+private:
+    ThreadPoolExecution(const ThreadPoolExecution &);
+    const ThreadPoolExecution & operator = (const ThreadPoolExecution &);
+
+    // run tasks of the current job until there's none left
+    void take_tasks(void) const
+    {
+        int n_finished = 0;
+        for (int i; (i = next_task.fetch_add(1)) < n_tasks; n_finished++) {
+            (*task)(i);
+        }
+
+        std::lock_guard<std::mutex> lock(mtx);
+        n_done += n_finished;
+    }
+
+    // main loop of worker threads
+    void work(void)
+    {
+        unsigned long seen = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+                n_active++;
+            }
+
+            take_tasks();
+
+            std::lock_guard<std::mutex> lock(mtx);
+            if (--n_active == 0) done.notify_all();
+        }
+    }
+
+    std::vector<std::thread> workers;
+
+    mutable std::mutex run_mtx;     // held by the thread running a job
+    mutable std::mutex mtx;         // protects the job description below
+    mutable std::condition_variable wake, done;
+
+    mutable const std::function<void(int)> *task;
+    mutable int n_tasks;
+    mutable std::atomic<int> next_task;
+    mutable int n_done;
+    mutable int n_active;           // workers working on the current job
+    mutable unsigned long generation;
+    bool stopping;
+};
+
+
+#ifdef _OPENMP
+/* Tasks are shared out by an OpenMP parallel loop */
+class OpenMPExecution: public ExecutionPolicy
+{
+public:
+    int concurrency(void) const {
+        return omp_get_max_threads();
+    }
+
+    void run(int n_tasks, const std::function<void(int)> &task) const
+    {
+        #pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < n_tasks; i++) task(i);
+    }
+};
+#endif /* _OPENMP */
+
+
+/* Rows of an image split into bands */
+struct __row_bands
+{
+    index_type band_rows;   // number of rows in a band (the last one may be
+                            // shorter)
+    int n_bands;
+};
+
+const size_t __band_bytes  = 128 * 1024;   // a band fits in the L2 cache
+const size_t __grain_bytes = 512 * 1024;   // smaller images stay serial
+
+/* Split n_rows rows of row_bytes bytes into bands for the given policy */
+inline __row_bands __SplitRows(
+    const ExecutionPolicy &exec, size_type n_rows, size_t row_bytes)
+{
+    __row_bands bands;
+    bands.band_rows = n_rows > 0? n_rows: 1;
+    bands.n_bands   = 1;
+
+    if (exec.concurrency() > 1 && row_bytes * n_rows >= __grain_bytes)
+    {
+        size_t rows = __band_bytes / (row_bytes > 0? row_bytes: 1);
+        bands.band_rows = rows > 0? (index_type)rows: 1;
+        bands.n_bands   = (n_rows + bands.band_rows - 1) / bands.band_rows;
+    }
+
+    return bands;
+}
+
+/* Call body(band, y_begin, y_end) for each band of rows, bands of a single
+   band are processed right on the calling thread. */
+template <typename _body_type>
+void ParallelBands(
+    const ExecutionPolicy &exec, const __row_bands &bands, size_type n_rows,
+    _body_type body)
+{
+    if (bands.n_bands <= 1) {
+        body(0, 0, n_rows);
+        return;
+    }
+
+    exec.run(bands.n_bands, [&](int band) {
+        index_type y_begin = band * bands.band_rows;
+        index_type y_end   = y_begin + bands.band_rows;
+        body(band, y_begin, y_end < n_rows? y_end: n_rows);
+    });
+}
+
+/* Call body(y_begin, y_end) for cache-sized bands of n_rows rows */
+template <typename _body_type>
+void ParallelRows(
+    const ExecutionPolicy &exec, size_type n_rows, size_t row_bytes,
+    _body_type body)
+{
+    ParallelBands(exec, __SplitRows(exec, n_rows, row_bytes), n_rows,
+        [&](int, index_type y_begin, index_type y_end) {
+            body(y_begin, y_end);
+        });
+}
+
+
+__BCP_END_NAMESPACE
+
+
+#endif /* __BCP_PARALLEL_HEADER__ */
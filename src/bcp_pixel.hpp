@@ -24,7 +24,7 @@ struct pixel_RGB
 struct pixel_Monochrome
 {
     int val;
-    pixel_Monochrome(int Val = 0): val(Val) {}
+    constexpr pixel_Monochrome(int Val = 0): val(Val) {}
 
     // black or white, quite simple rule.
     pixel_RGB RGB(void) const {
@@ -44,18 +44,66 @@ struct pixel_Grayscale
     }
 };
 
+/* Grayscale image stored a byte a pixel, a quarter of the memory of
+   pixel_Grayscale for the same gray levels */
+struct pixel_Gray8
+{
+    byte val;
+    pixel_Gray8(byte Val = 0): val(Val) {}
+
+    pixel_RGB RGB(void) const {
+        return pixel_RGB(val, val, val);
+    }
+};
+
+
+/* Lookup tables of the pixel conversions, generated at compile time */
+
+/* Weighted contribution of each channel to the gray level, for the empirical
+   equation
+
+       brightness = 0.3*red + 0.59*green + 0.11*blue
+
+   The products are the very ones the equation would compute, summed up in
+   the same order they give the same gray levels, without a multiplication. */
+struct __gray_weights_table
+{
+    double r[256], g[256], b[256];
+
+    constexpr __gray_weights_table(void): r(), g(), b()
+    {
+        for (int i = 0; i < 256; i++) {
+            r[i] = i * 0.30, g[i] = i * 0.59, b[i] = i * 0.11;
+        }
+    }
+};
+
+constexpr __gray_weights_table __gray_weights = __gray_weights_table();
+
+/* Gray level ==> monochrome pixel, white when the level reaches the
+   threshold. Built once per threshold by whatever thresholds many pixels. */
+struct __threshold_table
+{
+    pixel_Monochrome mono[256];
+
+    constexpr __threshold_table(int threshold): mono()
+    {
+        for (int i = 0; i < 256; i++) {
+            mono[i].val = i >= threshold? 1: 0;
+        }
+    }
+};
+
+// the fixed rule of the monochrome conversion: white above 127
+constexpr __threshold_table __gray_to_mono = __threshold_table(128);
+
 
 // RGB ==> Grayscale
 inline pixel_Grayscale 
 __convert_from_RGB_to(const pixel_RGB &px, pixel_Grayscale)
 {
-    /* The transition from RGB value to grayscale value is based on an 
-       empirical equation: 
-
-           brightness = 0.3*red + 0.59*green + 0.11*blue
-    */
-    return pixel_Grayscale(
-        px.r * 0.30 + px.g * 0.59 + px.b * 0.11 + 0.5);
+    return pixel_Grayscale(__gray_weights.r[px.r] + __gray_weights.g[px.g] +
+        __gray_weights.b[px.b] + 0.5);
 }
 
 // RGB ==> Monochrome
@@ -63,7 +111,14 @@ inline pixel_Monochrome
 __convert_from_RGB_to(const pixel_RGB &px, pixel_Monochrome)
 {
     pixel_Grayscale px_g = __convert_from_RGB_to(px, pixel_Grayscale());
-    return px_g.val > 127? pixel_Monochrome(1): pixel_Monochrome(0);
+    return __gray_to_mono.mono[px_g.val];
+}
+
+// RGB ==> Gray8
+inline pixel_Gray8
+__convert_from_RGB_to(const pixel_RGB &px, pixel_Gray8)
+{
+    return pixel_Gray8(__convert_from_RGB_to(px, pixel_Grayscale()).val);
 }
 
 // RGB ==> RGB
@@ -75,9 +130,9 @@ __convert_from_RGB_to(const pixel_RGB &px, pixel_RGB)
 }
 
 
-/* Convert pixel type from _pixel_ty_from to _pixel_ty_to. We always convert 
-   _pixel_ty_from to pixel_RGB first and then convert the RGB pixel to 
-   _pixel_ty_to.
+/* Convert pixel type from _pixel_ty_from to _pixel_ty_to. In general we
+   convert _pixel_ty_from to pixel_RGB first and then convert the RGB pixel
+   to _pixel_ty_to, the pixel types of ours are converted directly below.
 
    This function only works as a proxy/interface function, implementation of
    the actual converting procedure are dispatched to various overloaded versions
@@ -94,6 +149,70 @@ _pixel_ty_to ConvertPixel(const _pixel_ty_from &px_src, const _pixel_ty_to &)
     return __convert_from_RGB_to(px_src.RGB(), _pixel_ty_to());
 }
 
+/* Direct conversions between the pixel types of ours, picked over the
+   template above at compile time. They give the same pixels as going
+   through RGB, without the detour. Gray levels are taken modulo 256 as
+   pixel_Grayscale::RGB() does. */
+inline pixel_Grayscale
+ConvertPixel(const pixel_RGB &px, const pixel_Grayscale &) {
+    return __convert_from_RGB_to(px, pixel_Grayscale());
+}
+
+inline pixel_Monochrome
+ConvertPixel(const pixel_RGB &px, const pixel_Monochrome &) {
+    return __convert_from_RGB_to(px, pixel_Monochrome());
+}
+
+inline pixel_RGB
+ConvertPixel(const pixel_Grayscale &px, const pixel_RGB &) {
+    return px.RGB();
+}
+
+inline pixel_Monochrome
+ConvertPixel(const pixel_Grayscale &px, const pixel_Monochrome &) {
+    return __gray_to_mono.mono[(byte)px.val];
+}
+
+inline pixel_RGB
+ConvertPixel(const pixel_Monochrome &px, const pixel_RGB &) {
+    return px.RGB();
+}
+
+inline pixel_Grayscale
+ConvertPixel(const pixel_Monochrome &px, const pixel_Grayscale &) {
+    return pixel_Grayscale((byte)(px.val * 255));
+}
+
+inline pixel_Gray8
+ConvertPixel(const pixel_RGB &px, const pixel_Gray8 &) {
+    return __convert_from_RGB_to(px, pixel_Gray8());
+}
+
+inline pixel_RGB
+ConvertPixel(const pixel_Gray8 &px, const pixel_RGB &) {
+    return px.RGB();
+}
+
+inline pixel_Grayscale
+ConvertPixel(const pixel_Gray8 &px, const pixel_Grayscale &) {
+    return pixel_Grayscale(px.val);
+}
+
+inline pixel_Gray8
+ConvertPixel(const pixel_Grayscale &px, const pixel_Gray8 &) {
+    return pixel_Gray8((byte)px.val);
+}
+
+inline pixel_Monochrome
+ConvertPixel(const pixel_Gray8 &px, const pixel_Monochrome &) {
+    return __gray_to_mono.mono[px.val];
+}
+
+inline pixel_Gray8
+ConvertPixel(const pixel_Monochrome &px, const pixel_Gray8 &) {
+    return pixel_Gray8((byte)(px.val * 255));
+}
+
 
 /* Threshold a pixel according to its grayscale value */
 template <typename _pixel_type>
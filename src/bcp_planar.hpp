@@ -0,0 +1,217 @@
+#ifndef __BCP_PLANAR_IMAGE_HEADER__
+#define __BCP_PLANAR_IMAGE_HEADER__
+
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#include "bcp_image_def.hpp"
+
+/*
+  Planar RGB images: the red, green and blue components are stored in three
+  separate planes of bytes instead of interleaved pixels, so that a vector
+  load gets 16 to 64 pixels of the same component. Rows of a plane are
+  padded to a multiple of 64 bytes and the planes are allocated on a 64-byte
+  boundary, each row starts on a cache line.
+
+  Like Image, a PlanarImage gives the pixels of a row through row(y): the
+  whole-image operations of bcp_proc.hpp are written against rows and take
+  either kind of image.
+*/
+
+__BCP_BEGIN_NAMESPACE
+
+
+/* A pixel of a planar image being written: stores the components of the
+   RGB pixel assigned to it in their planes */
+struct __planar_pixel_ref
+{
+    byte *r, *g, *b;
+
+    const __planar_pixel_ref &operator = (const pixel_RGB &px) const {
+        *r = px.r, *g = px.g, *b = px.b;
+        return *this;
+    }
+    operator pixel_RGB(void) const {
+        return pixel_RGB(*r, *g, *b);
+    }
+};
+
+// Row of a planar image, indexed by x like the rows of an Image
+struct __planar_row
+{
+    byte *r, *g, *b;
+
+    __planar_pixel_ref operator [] (index_type x) const {
+        __planar_pixel_ref ref = { r + x, g + x, b + x };
+        return ref;
+    }
+};
+
+struct __const_planar_row
+{
+    const byte *r, *g, *b;
+
+    pixel_RGB operator [] (index_type x) const {
+        return pixel_RGB(r[x], g[x], b[x]);
+    }
+};
+
+
+// RGB image stored as 3 planes, see above
+class PlanarImage
+{
+public:
+    typedef pixel_RGB pixel_type;
+
+    // rows returned by row(y)
+    typedef __planar_row row_type;
+    typedef __const_planar_row const_row_type;
+
+    static const size_t alignment = 64;  // of the planes and their rows, in bytes
+
+    // initialize a white image of the specified size
+    PlanarImage(size_type image_width = 0, size_type image_height = 0)
+        : width(0), height(0), stride(0), data(NULL)
+    {
+        allocate(image_width, image_height);
+        memset(data, 255, plane_size() * 3);
+    }
+
+    // split the pixels of an interleaved image
+    PlanarImage(const Image<pixel_RGB> &img)
+        : width(0), height(0), stride(0), data(NULL)
+    {
+        allocate(img.get_width(), img.get_height());
+        memset(data, 255, plane_size() * 3);
+        for (index_type y = 0; y < height; y++)
+        {
+            const pixel_RGB *src = img.row(y);
+            __planar_row dst = row(y);
+            for (index_type x = 0; x < width; x++) {
+                dst.r[x] = src[x].r, dst.g[x] = src[x].g, dst.b[x] = src[x].b;
+            }
+        }
+    }
+
+    // initialize with a PPM image file
+    PlanarImage(const char *ppm_filename)
+        : width(0), height(0), stride(0), data(NULL)
+    {
+        *this = PlanarImage(Image<pixel_RGB>(ppm_filename));
+    }
+
+    PlanarImage(const PlanarImage &img)
+        : width(0), height(0), stride(0), data(NULL)
+    {
+        *this = img;
+    }
+
+    ~PlanarImage(void) {
+        free(data);
+    }
+
+    const PlanarImage &operator = (const PlanarImage &img)
+    {
+        if (this != &img)
+        {
+            allocate(img.width, img.height);
+            memcpy(data, img.data, plane_size() * 3);
+        }
+        return *this;
+    }
+
+
+    // get image metrics, the stride is the distance between rows in bytes
+    size_type get_width(void)  const { return width; }
+    size_type get_height(void) const { return height; }
+    size_type get_stride(void) const { return stride; }
+
+    // plane of the component c: 0 for red, 1 for green and 2 for blue
+    byte *plane(int c) {
+        return data + plane_size() * c;
+    }
+    const byte *plane(int c) const {
+        return data + plane_size() * c;
+    }
+
+    // pixels of row y in the 3 planes
+    __planar_row row(index_type y)
+    {
+        assert(y >= 0 && y < height);
+        size_t offset = (size_t)y * stride;
+        __planar_row r = { plane(0) + offset, plane(1) + offset,
+            plane(2) + offset };
+        return r;
+    }
+    __const_planar_row row(index_type y) const
+    {
+        assert(y >= 0 && y < height);
+        size_t offset = (size_t)y * stride;
+        __const_planar_row r = { plane(0) + offset, plane(1) + offset,
+            plane(2) + offset };
+        return r;
+    }
+
+    // a single pixel, checked like Image::operator ()
+    pixel_RGB operator () (index_type m, index_type n) const
+    {
+        assert(m >= 0 && m < width);
+        return row(n)[m];
+    }
+
+
+    // merge the planes back into an interleaved image
+    Image<pixel_RGB> interleaved(void) const
+    {
+        Image<pixel_RGB> img(width, height);
+        for (index_type y = 0; y < height; y++)
+        {
+            __const_planar_row src = row(y);
+            pixel_RGB *dst = img.row(y);
+            for (index_type x = 0; x < width; x++) {
+                dst[x] = pixel_RGB(src.r[x], src.g[x], src.b[x]);
+            }
+        }
+        return img;
+    }
+
+    // save the image as a PPM6 image
+    void save_ppm(const char *ppm_filename) const {
+        interleaved().save_ppm(ppm_filename);
+    }
+
+
+private:
+    size_t plane_size(void) const {
+        return (size_t)stride * height;
+    }
+
+    // (re)allocate the planes for an image of the specified size
+    void allocate(size_type image_width, size_type image_height)
+    {
+        size_type image_stride =
+            (image_width + alignment - 1) / alignment * alignment;
+        size_t size = (size_t)image_stride * image_height * 3;
+
+        void *p = NULL;
+        if (posix_memalign(&p, alignment, size > 0? size: alignment) != 0)
+            throw std::bad_alloc();
+
+        free(data);
+        data = (byte*)p;
+        width = image_width, height = image_height, stride = image_stride;
+    }
+
+    size_type width, height;     // size of the image: width x height
+    size_type stride;            // bytes between rows of a plane
+    byte *data;                  // the red, green and blue planes
+};
+
+
+__BCP_END_NAMESPACE
+
+
+#endif /* __BCP_PLANAR_IMAGE_HEADER__ */
@@ -7,27 +7,122 @@
 #include <cmath>
 
 #include "bcp_image_def.hpp"
+#include "bcp_planar.hpp"
+#include "bcp_kernels.hpp"
+#include "bcp_parallel.hpp"
 #include "ppm_io.hpp"
 
 __BCP_BEGIN_NAMESPACE
 
 
+/* All whole-image operations below take an optional execution policy, rows
+   of the image are processed in bands on it, see bcp_parallel.hpp. They run
+   serially on the calling thread by default.
+
+   The generic versions walk through the images a row at a time with row(y),
+   so they take an Image of any pixel type as well as a PlanarImage. */
+
+
 /* Convert the image from one type to another, it works through converting the 
    type of pixels using ConvertPixel().
 */
 template <typename _image_ty_from, typename _image_ty_to>
-_image_ty_to ConvertImage(const _image_ty_from &img, const _image_ty_to &)
+_image_ty_to ConvertImage(const _image_ty_from &img, const _image_ty_to &,
+    const ExecutionPolicy &exec = SerialPolicy())
 {
+    typedef typename _image_ty_to::pixel_type pixel_ty_to;
+
     // allocate for the resulting image
     _image_ty_to ret_img(img.get_width(), img.get_height());
 
-    // convert each pixel to the destination type.
-    for (index_type y = 0; y < img.get_height(); y++)
+    /* convert each pixel to the destination type, the ConvertPixel()
+       overload for the two types is picked at compile time */
+    size_type width = img.get_width();
+    ParallelRows(exec, img.get_height(),
+        width * sizeof(typename _image_ty_from::pixel_type),
+        [&](index_type y_begin, index_type y_end)
     {
-        for (index_type x = 0; x < img.get_width(); x++) {
-            ret_img(x,y) = ConvertPixel(img(x,y), ret_img(0,0));
+        for (index_type y = y_begin; y < y_end; y++)
+        {
+            typename _image_ty_from::const_row_type src = img.row(y);
+            typename _image_ty_to::row_type dst = ret_img.row(y);
+            for (index_type x = 0; x < width; x++) {
+                dst[x] = ConvertPixel(src[x], pixel_ty_to());
+            }
         }
-    }
+    });
+
+    return ret_img;
+}
+
+/* RGB ==> Grayscale and RGB ==> Monochrome are done by the pixel kernels,
+   see bcp_kernels.hpp */
+inline Image<pixel_Grayscale> ConvertImage(
+    const Image<pixel_RGB> &img, const Image<pixel_Grayscale> &,
+    const ExecutionPolicy &exec = SerialPolicy())
+{
+    Image<pixel_Grayscale> ret_img(img.get_width(), img.get_height());
+    size_type width = img.get_width();
+
+    ParallelRows(exec, img.get_height(), width * sizeof(pixel_RGB),
+        [&](index_type y_begin, index_type y_end)
+    {
+        PixelKernels().rgb_to_gray(
+            (const byte*)(img.get_pixels() + y_begin * width),
+            (int*)(ret_img.get_pixels() + y_begin * width),
+            (y_end - y_begin) * width);
+    });
+
+    return ret_img;
+}
+
+inline Image<pixel_Monochrome> ThresholdImage(
+    const Image<pixel_RGB> &img, int threshold, const ExecutionPolicy &exec);
+
+inline Image<pixel_Monochrome> ConvertImage(
+    const Image<pixel_RGB> &img, const Image<pixel_Monochrome> &,
+    const ExecutionPolicy &exec = SerialPolicy())
+{
+    // the same rule as __convert_from_RGB_to(px, pixel_Monochrome())
+    return ThresholdImage(img, 128, exec);
+}
+
+/* RGB ==> 8-bit grayscale, from interleaved or planar pixels */
+inline Image<pixel_Gray8> ConvertImage(
+    const Image<pixel_RGB> &img, const Image<pixel_Gray8> &,
+    const ExecutionPolicy &exec = SerialPolicy())
+{
+    Image<pixel_Gray8> ret_img(img.get_width(), img.get_height());
+    size_type width = img.get_width();
+
+    ParallelRows(exec, img.get_height(), width * sizeof(pixel_RGB),
+        [&](index_type y_begin, index_type y_end)
+    {
+        PixelKernels().rgb_to_gray8(
+            (const byte*)img.row(y_begin), (byte*)ret_img.row(y_begin),
+            (y_end - y_begin) * width);
+    });
+
+    return ret_img;
+}
+
+inline Image<pixel_Gray8> ConvertImage(
+    const PlanarImage &img, const Image<pixel_Gray8> &,
+    const ExecutionPolicy &exec = SerialPolicy())
+{
+    Image<pixel_Gray8> ret_img(img.get_width(), img.get_height());
+    size_type width = img.get_width();
+
+    ParallelRows(exec, img.get_height(), width * sizeof(pixel_RGB),
+        [&](index_type y_begin, index_type y_end)
+    {
+        for (index_type y = y_begin; y < y_end; y++)
+        {
+            PlanarImage::const_row_type src = img.row(y);
+            PixelKernels().planar_to_gray8(src.r, src.g, src.b,
+                (byte*)ret_img.row(y), width);
+        }
+    });
 
     return ret_img;
 }
@@ -40,6 +135,15 @@ void LoadPPMImage(const char *ppm_filename, Image<_pixel_type> &img)
     __load_ppm_image(ppm_filename, img);
 }
 
+/* The same, with the file read through io, see AsyncFileIO */
+template <typename _pixel_type>
+void LoadPPMImage(AsyncFileIO &io, const char *ppm_filename,
+    Image<_pixel_type> &img)
+{
+    PPMStripReader reader(io, ppm_filename);
+    reader.read_image(img);
+}
+
 /* An overloaded version which returns an Image object */
 template <typename _image_type>
 _image_type LoadPPMImage(const char *ppm_filename)
@@ -50,6 +154,16 @@ _image_type LoadPPMImage(const char *ppm_filename)
     return ConvertImage(rgb_img, _image_type());
 }
 
+/* Read the rect [left, right] x [top, bottom] of the image being read by
+   reader, without loading the rest of it */
+template <typename _pixel_type>
+void LoadPPMRegion(PPMStripReader &reader,
+    index_type left, index_type right, index_type top, index_type bottom,
+    Image<_pixel_type> &region)
+{
+    __load_ppm_region(reader, left, right, top, bottom, region);
+}
+
 /* Save specified Image object to an PPM6 archive */
 template <typename _pixel_type>
 void SavePPM6Image(const char *ppm_filename, const Image<_pixel_type> &img)
@@ -57,63 +171,120 @@ void SavePPM6Image(const char *ppm_filename, const Image<_pixel_type> &img)
     __save_ppm_image(ppm_filename, img);
 }
 
+/* Queue the image to be saved through io, errors are thrown by io.flush() */
+template <typename _pixel_type>
+void SavePPM6Image(AsyncFileIO &io, const char *ppm_filename,
+    const Image<_pixel_type> &img)
+{
+    __save_ppm_image(io, ppm_filename, img);
+}
+
 
 /* Create a transposed version of the image */
-template <typename _pixel_type>
-Image<_pixel_type> TransposeImage(const Image<_pixel_type> &img)
+template <typename _image_type>
+_image_type TransposeImage(const _image_type &img,
+    const ExecutionPolicy &exec = SerialPolicy())
 {
-    Image<_pixel_type> img_trans(img.get_height(), img.get_width());
+    _image_type img_trans(img.get_height(), img.get_width());
     
-    for (index_type x = 0; x < img.get_width(); x++)
+    ParallelRows(exec, img.get_height(),
+        img.get_width() * sizeof(typename _image_type::pixel_type),
+        [&](index_type y_begin, index_type y_end)
     {
-        for (index_type y = 0; y < img.get_height(); y++) {
-            img_trans(y,x) = img(x,y);    // transpose
+        for (index_type x = 0; x < img.get_width(); x++)
+        {
+            typename _image_type::row_type dst = img_trans.row(x);
+            for (index_type y = y_begin; y < y_end; y++) {
+                dst[y] = img.row(y)[x];    // transpose
+            }
         }
-    }
+    });
 
     return img_trans;
 }
 
+/* Monochrome and grayscale pixels are 32-bit, they are transposed tile by
+   tile by the pixel kernels */
+template <typename _pixel_type>
+Image<_pixel_type> __TransposeImage32(
+    const Image<_pixel_type> &img, const ExecutionPolicy &exec)
+{
+    Image<_pixel_type> img_trans(img.get_height(), img.get_width());
+    size_type width = img.get_width(), height = img.get_height();
+
+    // a band of rows of img is a band of columns of img_trans
+    ParallelRows(exec, height, width * sizeof(_pixel_type),
+        [&](index_type y_begin, index_type y_end)
+    {
+        PixelKernels().transpose32(
+            (const int*)(img.get_pixels() + y_begin * width),
+            (int*)(img_trans.get_pixels() + y_begin),
+            width, y_end - y_begin, height);
+    });
+
+    return img_trans;
+}
+
+inline Image<pixel_Monochrome> TransposeImage(
+    const Image<pixel_Monochrome> &img,
+    const ExecutionPolicy &exec = SerialPolicy()) {
+    return __TransposeImage32(img, exec);
+}
+
+inline Image<pixel_Grayscale> TransposeImage(
+    const Image<pixel_Grayscale> &img,
+    const ExecutionPolicy &exec = SerialPolicy()) {
+    return __TransposeImage32(img, exec);
+}
+
 
 /* Rotate the image certain rads around the specified point */
-template <typename _pixel_type>
-Image<_pixel_type> RotateImage(const Image<_pixel_type> &img, 
-    double rad, index_type cx, index_type cy)
+template <typename _image_type>
+_image_type RotateImage(const _image_type &img, 
+    double rad, index_type cx, index_type cy,
+    const ExecutionPolicy &exec = SerialPolicy())
 {
-    Image<_pixel_type> img_rot(img.get_width(), img.get_height());
+    typedef typename _image_type::pixel_type pixel_type;
+
+    _image_type img_rot(img.get_width(), img.get_height());
     double sin_phi = std::sin(rad), cos_phi = std::cos(rad);
 
     /* prepare a white pixel for furture use. any parts rotated in from the
        outside world are filled with white pixels. */
-    _pixel_type white_pixel = 
-        ConvertPixel(pixel_RGB(255,255,255), _pixel_type());
+    pixel_type white_pixel = 
+        ConvertPixel(pixel_RGB(255,255,255), pixel_type());
 
-    for (index_type y = 0; y < img.get_height(); y++)
+    ParallelRows(exec, img.get_height(), img.get_width() * sizeof(pixel_type),
+        [&](index_type y_begin, index_type y_end)
     {
-        for (index_type x = 0; x < img.get_width(); x++)
+        for (index_type y = y_begin; y < y_end; y++)
         {
-            /* translated pixel coordinate after moving the center to the 
-               original point*/
-            int tx = x - cx, ty = y - cy;
-
-            // rotate around the original point
-            double rx_d = tx * cos_phi - ty * sin_phi, 
-                   ry_d = tx * sin_phi + ty * cos_phi;
-
-            // round to nearest integer and translate back
-            index_type rx = (index_type)(rx_d + 0.5) + cx,
-                       ry = (index_type)(ry_d + 0.5) + cy;
-
-            if (rx >= 0 && rx < img.get_width() && 
-                ry >= 0 && ry < img.get_height())
+            typename _image_type::row_type dst = img_rot.row(y);
+            for (index_type x = 0; x < img.get_width(); x++)
             {
-                img_rot(x,y) = img(rx,ry);    // in bound
-            }
-            else {
-                img_rot(x,y) = white_pixel;   // outside world rolled in
+                /* translated pixel coordinate after moving the center to the 
+                   original point*/
+                int tx = x - cx, ty = y - cy;
+
+                // rotate around the original point
+                double rx_d = tx * cos_phi - ty * sin_phi, 
+                       ry_d = tx * sin_phi + ty * cos_phi;
+
+                // round to nearest integer and translate back
+                index_type rx = (index_type)(rx_d + 0.5) + cx,
+                           ry = (index_type)(ry_d + 0.5) + cy;
+
+                if (rx >= 0 && rx < img.get_width() && 
+                    ry >= 0 && ry < img.get_height())
+                {
+                    dst[x] = img.row(ry)[rx];     // in bound
+                }
+                else {
+                    dst[x] = white_pixel;         // outside world rolled in
+                }
             }
         }
-    }
+    });
 
     return img_rot;
 }
@@ -122,23 +293,32 @@ Image<_pixel_type> RotateImage(const Image<_pixel_type> &img,
 /* Crop img to specified rect, return the cropped image. This function will
    not hurt the original image specified in parameter list.
 */
-template <typename _pixel_type>
-Image<_pixel_type> CropImage(
-    const Image<_pixel_type> &img,
-    index_type left, index_type right, index_type top, index_type bottom)
+template <typename _image_type>
+_image_type CropImage(
+    const _image_type &img,
+    index_type left, index_type right, index_type top, index_type bottom,
+    const ExecutionPolicy &exec = SerialPolicy())
 {
     assert(left < right && top < bottom);
+    assert(left >= 0 && right < img.get_width());
 
     // create a cropped image
-    Image<_pixel_type> piece(right - left + 1, bottom - top + 1);
+    _image_type piece(right - left + 1, bottom - top + 1);
 
     // copy pixels in the specified rect to the cropped piece.
-    for (index_type y = top, py = 0; y <= bottom; y++, py++)
+    ParallelRows(exec, piece.get_height(),
+        piece.get_width() * sizeof(typename _image_type::pixel_type),
+        [&](index_type py_begin, index_type py_end)
     {
-        for (index_type x = left, px = 0; x <= right; x++, px++) {
-            piece(px,py) = img(x,y);
+        for (index_type py = py_begin, y = top + py_begin; py < py_end; y++, py++)
+        {
+            typename _image_type::const_row_type src = img.row(y);
+            typename _image_type::row_type dst = piece.row(py);
+            for (index_type x = left, px = 0; x <= right; x++, px++) {
+                dst[px] = src[x];
+            }
         }
-    }
+    });
 
     return piece;
 }
@@ -147,46 +327,127 @@ Image<_pixel_type> CropImage(
 /* Convert an RGB or grayscale image to a monochrome one using specified 
    threshold 
 */
-template <typename _pixel_type>
+template <typename _image_type>
 Image<pixel_Monochrome> ThresholdImage(
-    const Image<_pixel_type> &img, int threshold)
+    const _image_type &img, int threshold,
+    const ExecutionPolicy &exec = SerialPolicy())
 {
     Image<pixel_Monochrome> binimg(img.get_width(), img.get_height());
 
-    // thresholding each pixel using ThresholdPixel()
-    for (index_type y = 0; y < img.get_height(); y++)
+    /* thresholding each pixel like ThresholdPixel(), the gray levels are
+       looked up in a table made for this threshold */
+    const __threshold_table table(threshold);
+    ParallelRows(exec, img.get_height(),
+        img.get_width() * sizeof(typename _image_type::pixel_type),
+        [&](index_type y_begin, index_type y_end)
     {
-        for (index_type x = 0; x < img.get_width(); x++) {
-            binimg(x,y) = ThresholdPixel(img(x,y), threshold);
+        for (index_type y = y_begin; y < y_end; y++)
+        {
+            typename _image_type::const_row_type src = img.row(y);
+            pixel_Monochrome *dst = binimg.row(y);
+            for (index_type x = 0; x < img.get_width(); x++) {
+                dst[x] = table.mono[
+                    ConvertPixel(src[x], pixel_Grayscale()).val];
+            }
         }
-    }
+    });
 
     return binimg;
 }
 
+/* Thresholding RGB and grayscale images is done by the pixel kernels */
+inline Image<pixel_Monochrome> ThresholdImage(
+    const Image<pixel_RGB> &img, int threshold,
+    const ExecutionPolicy &exec = SerialPolicy())
+{
+    Image<pixel_Monochrome> binimg(img.get_width(), img.get_height());
+    size_type width = img.get_width();
 
-/* Otsu's algorithm picks up a reasonable threshold value according to the
-   histogram of the image. */
-template <typename _pixel_type>
-int OtsuThresholdSelector(const Image<_pixel_type> &img)
+    ParallelRows(exec, img.get_height(), width * sizeof(pixel_RGB),
+        [&](index_type y_begin, index_type y_end)
+    {
+        PixelKernels().rgb_threshold(
+            (const byte*)(img.get_pixels() + y_begin * width),
+            (int*)(binimg.get_pixels() + y_begin * width),
+            (y_end - y_begin) * width, threshold);
+    });
+
+    return binimg;
+}
+
+inline Image<pixel_Monochrome> ThresholdImage(
+    const Image<pixel_Grayscale> &img, int threshold,
+    const ExecutionPolicy &exec = SerialPolicy())
 {
-    int width  = img.get_width();
-    int height = img.get_height();
-      
-    //histogram
-    float histogram[256] = {0};
-    for (int y = 0; y < height; y++)
+    Image<pixel_Monochrome> binimg(img.get_width(), img.get_height());
+    size_type width = img.get_width();
+
+    ParallelRows(exec, img.get_height(), width * sizeof(pixel_Grayscale),
+        [&](index_type y_begin, index_type y_end)
     {
-        for(int x = 0; x < width; x++) {
-            int val = ConvertPixel(img(x,y), pixel_Grayscale()).val;
-            histogram[val]++;  
+        PixelKernels().gray_threshold(
+            (const int*)(img.get_pixels() + y_begin * width),
+            (int*)(binimg.get_pixels() + y_begin * width),
+            (y_end - y_begin) * width, threshold);
+    });
+
+    return binimg;
+}
+
+
+/* 8-bit grayscale images are thresholded by the pixel kernels, planar RGB
+   images are converted to 8-bit gray levels a row at a time first */
+inline Image<pixel_Monochrome> ThresholdImage(
+    const Image<pixel_Gray8> &img, int threshold,
+    const ExecutionPolicy &exec = SerialPolicy())
+{
+    Image<pixel_Monochrome> binimg(img.get_width(), img.get_height());
+    size_type width = img.get_width();
+
+    ParallelRows(exec, img.get_height(), width * sizeof(pixel_Gray8),
+        [&](index_type y_begin, index_type y_end)
+    {
+        PixelKernels().gray8_threshold(
+            (const byte*)img.row(y_begin), (int*)binimg.row(y_begin),
+            (y_end - y_begin) * width, threshold);
+    });
+
+    return binimg;
+}
+
+inline Image<pixel_Monochrome> ThresholdImage(
+    const PlanarImage &img, int threshold,
+    const ExecutionPolicy &exec = SerialPolicy())
+{
+    Image<pixel_Monochrome> binimg(img.get_width(), img.get_height());
+    size_type width = img.get_width();
+
+    ParallelRows(exec, img.get_height(), width * sizeof(pixel_RGB),
+        [&](index_type y_begin, index_type y_end)
+    {
+        const __pixel_kernels &k = PixelKernels();
+        std::vector<byte> gray(width);
+        for (index_type y = y_begin; y < y_end; y++)
+        {
+            PlanarImage::const_row_type src = img.row(y);
+            k.planar_to_gray8(src.r, src.g, src.b, &gray[0], width);
+            k.gray8_threshold(&gray[0], (int*)binimg.row(y), width, threshold);
         }
-    }
+    });
 
+    return binimg;
+}
+
+
+/* Otsu's algorithm picks up a reasonable threshold value according to the
+   histogram of the image, `counts' is the grayscale histogram of an image
+   with `size' pixels. */
+inline int __OtsuThreshold(const int counts[256], int size)
+{
     //normalize histogram  
-    int size = height * width;
+    float histogram[256];
     for(int i = 0; i < 256; i++) {
-        histogram[i] = histogram[i] / size;
+        histogram[i] = (float)counts[i] / size;
     }
     
     //average pixel value
@@ -212,6 +473,102 @@ int OtsuThresholdSelector(const Image<_pixel_type> &img)
     return threshold;
 }
 
+/* Each band of rows gets its own histogram, which are summed up at last */
+template <typename _image_type, typename _band_histogram_fn>
+int __OtsuThresholdSelector(const _image_type &img,
+    const ExecutionPolicy &exec, _band_histogram_fn band_histogram)
+{
+    int width  = img.get_width();
+    int height = img.get_height();
+
+    __row_bands bands = __SplitRows(exec, height,
+        width * sizeof(typename _image_type::pixel_type));
+    std::vector<int> band_hist(bands.n_bands * 256, 0);
+
+    ParallelBands(exec, bands, height,
+        [&](int band, index_type y_begin, index_type y_end) {
+            band_histogram(y_begin, y_end, &band_hist[band * 256]);
+        });
+
+    //histogram
+    int histogram[256] = {0};
+    for (int band = 0; band < bands.n_bands; band++)
+    {
+        for (int i = 0; i < 256; i++) {
+            histogram[i] += band_hist[band * 256 + i];
+        }
+    }
+
+    return __OtsuThreshold(histogram, height * width);
+}
+
+template <typename _image_type>
+int OtsuThresholdSelector(const _image_type &img,
+    const ExecutionPolicy &exec = SerialPolicy())
+{
+    return __OtsuThresholdSelector(img, exec,
+        [&](index_type y_begin, index_type y_end, int *histogram)
+    {
+        for (int y = y_begin; y < y_end; y++)
+        {
+            typename _image_type::const_row_type src = img.row(y);
+            for(int x = 0; x < img.get_width(); x++) {
+                int val = ConvertPixel(src[x], pixel_Grayscale()).val;
+                histogram[val]++;  
+            }
+        }
+    });
+}
+
+// histogram of RGB images are built by the pixel kernels
+inline int OtsuThresholdSelector(const Image<pixel_RGB> &img,
+    const ExecutionPolicy &exec = SerialPolicy())
+{
+    size_type width = img.get_width();
+
+    return __OtsuThresholdSelector(img, exec,
+        [&](index_type y_begin, index_type y_end, int *histogram)
+    {
+        PixelKernels().rgb_histogram(
+            (const byte*)(img.get_pixels() + y_begin * width),
+            (y_end - y_begin) * width, histogram);
+    });
+}
+
+// histograms of 8-bit grayscale and planar RGB images, the same way
+inline int OtsuThresholdSelector(const Image<pixel_Gray8> &img,
+    const ExecutionPolicy &exec = SerialPolicy())
+{
+    size_type width = img.get_width();
+
+    return __OtsuThresholdSelector(img, exec,
+        [&](index_type y_begin, index_type y_end, int *histogram)
+    {
+        PixelKernels().gray8_histogram((const byte*)img.row(y_begin),
+            (y_end - y_begin) * width, histogram);
+    });
+}
+
+inline int OtsuThresholdSelector(const PlanarImage &img,
+    const ExecutionPolicy &exec = SerialPolicy())
+{
+    size_type width = img.get_width();
+
+    return __OtsuThresholdSelector(img, exec,
+        [&](index_type y_begin, index_type y_end, int *histogram)
+    {
+        const __pixel_kernels &k = PixelKernels();
+        std::vector<byte> gray((size_t)(y_end - y_begin) * width);
+        for (index_type y = y_begin; y < y_end; y++)
+        {
+            PlanarImage::const_row_type src = img.row(y);
+            k.planar_to_gray8(src.r, src.g, src.b,
+                &gray[(size_t)(y - y_begin) * width], width);
+        }
+        k.gray8_histogram(gray.data(), gray.size(), histogram);
+    });
+}
+
 /* Use a 1D ray to detect the density of the image on a line, it accumulates all
    black dots on specified monochrome image and return the final sum value. 
 
@@ -244,6 +601,44 @@ int RayDetection(const Image<_pixel_type> &img, double k, index_type y0)
     return n_black;
 }
 
+/* A ray across a monochrome image goes through runs of consecutive pixels on
+   the same row, each run is counted at once by the pixel kernels. The pixels
+   visited are exactly the ones visited by the generic version above. */
+inline int RayDetection(
+    const Image<pixel_Monochrome> &img, double k, index_type y0)
+{
+    size_type 
+        width = img.get_width(), 
+        height = img.get_height();
+
+    const int *px = (const int*)img.get_pixels();
+    int (*count_black)(const int*, size_type) = PixelKernels().count_black;
+    int n_black = 0;
+
+    for (index_type x = 0; x < width; )
+    {
+        index_type y = index_type(y0 + x*k);
+        if (y < 0 || y >= height) break;
+
+        /* guess where the ray leaves this row, then move the guess to the 
+           exact end of the run */
+        index_type x_end = width;
+        if (k != 0)
+        {
+            double guess = ((k > 0? y + 1: y) - y0) / k;
+            if (guess < width)
+                x_end = guess > x + 1? (index_type)guess: x + 1;
+        }
+        while (x_end > x + 1 && index_type(y0 + (x_end - 1)*k) != y) x_end--;
+        while (x_end < width && index_type(y0 + x_end*k) == y) x_end++;
+
+        n_black += count_black(px + y * width + x, x_end - x);
+        x = x_end;
+    }
+    
+    return n_black;
+}
+
 
 /* Project the image onto a 1D "plane" by accumulating black dots on parallel 
    rays using RayDetection method. Monochrome image is strongly recommended 
@@ -0,0 +1,189 @@
+#ifndef __BCP_PYRAMID_HEADER__
+#define __BCP_PYRAMID_HEADER__
+
+
+#include <vector>
+#include <algorithm>
+
+#include "bcp_image.hpp"
+#include "bcp_locate.hpp"
+
+/*
+  Coarse localization of the row of codes. The target box of a layout is
+  where the codes usually are, pages fed with a larger shift have them partly
+  outside of it. The area around the box is downsampled 4x and 8x, the row
+  of codes is found on the 8x level by tomography projection in both axes,
+  refined on the 4x level, and the target box is moved onto it.
+*/
+
+__BCP_BEGIN_NAMESPACE
+
+
+/* Downsample the rect (x0, y0, width, height) of img by `factor', each pixel
+   of the result is the mean gray level of a factor x factor block. Blocks
+   sticking out of the rect are left out. */
+template <typename _pixel_type>
+Image<pixel_Grayscale> DownsampleImage(const Image<_pixel_type> &img,
+    int factor, index_type x0, index_type y0, size_type width, size_type height,
+    const ExecutionPolicy &exec = SerialPolicy())
+{
+    Image<pixel_Grayscale> small(width / factor, height / factor);
+    size_type small_width = small.get_width();
+    int area = factor * factor;
+
+    ParallelRows(exec, small.get_height(),
+        width * factor * sizeof(_pixel_type),
+        [&](index_type y_begin, index_type y_end)
+    {
+        // sums of the channels of the blocks of a row
+        std::vector<int> r(small_width), g(small_width), b(small_width);
+
+        for (index_type y = y_begin; y < y_end; y++)
+        {
+            std::fill(r.begin(), r.end(), 0);
+            std::fill(g.begin(), g.end(), 0);
+            std::fill(b.begin(), b.end(), 0);
+
+            for (index_type sy = y * factor; sy < (y + 1) * factor; sy++)
+            {
+                const _pixel_type *row =
+                    img.get_pixels() + (y0 + sy) * img.get_width() + x0;
+                for (index_type x = 0, sx = 0; x < small_width; x++)
+                {
+                    for (int i = 0; i < factor; i++, sx++) {
+                        pixel_RGB px = row[sx].RGB();
+                        r[x] += px.r, g[x] += px.g, b[x] += px.b;
+                    }
+                }
+            }
+
+            // gray level of the mean color, the same as the mean gray level
+            for (index_type x = 0; x < small_width; x++) {
+                small(x,y) = ConvertPixel(pixel_RGB(
+                    (r[x] + area / 2) / area, (g[x] + area / 2) / area,
+                    (b[x] + area / 2) / area), pixel_Grayscale());
+            }
+        }
+    });
+
+    return small;
+}
+
+/* Downsample the whole image */
+template <typename _pixel_type>
+Image<pixel_Grayscale> DownsampleImage(const Image<_pixel_type> &img,
+    int factor, const ExecutionPolicy &exec = SerialPolicy())
+{
+    return DownsampleImage(img, factor, 0, 0,
+        img.get_width(), img.get_height(), exec);
+}
+
+
+/* Where a row of codes seems to be on a downsampled image */
+struct __Coarse_Location
+{
+    index_type x, y;    // upper left corner of the row
+    int confidence;     // black pixels in the row
+};
+
+/* Find the densest row_width x row_height rect of the rect (x0, y0, width,
+   height) of a level of the pyramid: the densest band as tall as the row by
+   projecting the rows, then the densest part of the band as wide as the row
+   by projecting its columns. The result is relative to the level. */
+inline __Coarse_Location __LocateCodeRowOnLevel(
+    const Image<pixel_Grayscale> &level,
+    index_type x0, index_type y0, size_type width, size_type height,
+    size_type row_width, size_type row_height)
+{
+    row_width  = std::max(1, std::min(row_width, width));
+    row_height = std::max(1, std::min(row_height, height));
+
+    Image<pixel_Grayscale> rect =
+        CropImage(level, x0, x0 + width - 1, y0, y0 + height - 1);
+    Image<pixel_Monochrome> mono =
+        ThresholdImage(rect, OtsuThresholdSelector(rect));
+
+    std::vector<int> rows = TomographyProjection(mono, 0);
+    __2Dcode_Location band = __Estimate2DcodeLocation(rows, row_height);
+
+    Image<pixel_Monochrome> columns(row_height, width);
+    for (index_type y = 0; y < row_height; y++)
+    {
+        for (index_type x = 0; x < width; x++) {
+            columns(y,x) = mono(x, band.y0 + y);
+        }
+    }
+    std::vector<int> cols = TomographyProjection(columns, 0);
+    __2Dcode_Location along = __Estimate2DcodeLocation(cols, row_width);
+
+    __Coarse_Location loc;
+    loc.x = x0 + along.y0;
+    loc.y = y0 + band.y0;
+    loc.confidence = along.confidence;
+    return loc;
+}
+
+/* Look for the row of codes up to `margin' pixels around the target box of
+   the layout, whose upper left corner is (box_x0, box_y0) in img. When the
+   row found is not completely inside the box, or starts too far right for
+   the search of the first code, the box is moved to have the row in its
+   middle and (box_x0, box_y0) is updated. The box is kept inside img.
+   Returns whether the box was moved. */
+template <typename _layout_type, typename _pixel_type>
+bool LocateTargetBox(const Image<_pixel_type> &img,
+    const _layout_type &layout, int margin,
+    index_type &box_x0, index_type &box_y0,
+    const ExecutionPolicy &exec = SerialPolicy())
+{
+    const size_type box_width = layout.target_width;
+    const size_type box_height = layout.target_height;
+    const size_type row_width = layout.n_codes * layout.code_size +
+        (layout.n_codes - 1) * layout.code_padding;
+    const size_type row_height = layout.code_size;
+
+    // the area searched, on the 4x and 8x levels of the pyramid
+    index_type x0 = std::max(box_x0 - margin, 0);
+    index_type y0 = std::max(box_y0 - margin, 0);
+    index_type x1 = std::min(box_x0 + box_width + margin, img.get_width());
+    index_type y1 = std::min(box_y0 + box_height + margin, img.get_height());
+
+    Image<pixel_Grayscale> level4 =
+        DownsampleImage(img, 4, x0, y0, x1 - x0, y1 - y0, exec);
+    Image<pixel_Grayscale> level8 = DownsampleImage(level4, 2, exec);
+    if (level8.get_width() < row_width / 8 + 1 ||
+        level8.get_height() < row_height / 8 + 1)
+        return false;
+
+    __Coarse_Location loc = __LocateCodeRowOnLevel(level8,
+        0, 0, level8.get_width(), level8.get_height(),
+        row_width / 8, row_height / 8);
+
+    // refine within 2 pixels of the 4x level around it
+    index_type rx0 = std::max(loc.x * 2 - 2, 0);
+    index_type ry0 = std::max(loc.y * 2 - 2, 0);
+    index_type rx1 = std::min(loc.x * 2 + row_width / 4 + 2, level4.get_width());
+    index_type ry1 = std::min(loc.y * 2 + row_height / 4 + 2, level4.get_height());
+    loc = __LocateCodeRowOnLevel(level4, rx0, ry0, rx1 - rx0, ry1 - ry0,
+        row_width / 4, row_height / 4);
+
+    /* the box is kept when the row is inside it, with the first code
+       starting before code_left, give or take a pixel of the 4x level */
+    index_type row_x = x0 + loc.x * 4, row_y = y0 + loc.y * 4;
+    if (row_x >= box_x0 && row_x + row_width <= box_x0 + box_width &&
+        row_x + 4 < box_x0 + layout.code_left &&
+        row_y >= box_y0 && row_y + row_height <= box_y0 + box_height)
+        return false;
+
+    box_x0 = row_x - std::min((box_width - row_width) / 2,
+        (size_type)layout.code_left / 2);
+    box_y0 = row_y - (box_height - row_height) / 2;
+    box_x0 = std::max(0, std::min(box_x0, img.get_width() - box_width - 1));
+    box_y0 = std::max(0, std::min(box_y0, img.get_height() - box_height - 1));
+    return true;
+}
+
+
+__BCP_END_NAMESPACE
+
+
+#endif /* __BCP_PYRAMID_HEADER__ */
@@ -0,0 +1,181 @@
+#ifndef __BCP_PART_SCORE_HEADER__
+#define __BCP_PART_SCORE_HEADER__
+
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include "bcp_image.hpp"
+#include "bcp_locate.hpp"
+
+/*
+  How much a split part looks like a 2D code, cheap enough to be computed
+  for every part before it goes to the decoder. A code is a grid of square
+  modules, about half of them black, so a part is scored on
+
+    - its ink: the part of its pixels which are black,
+    - its edges: black/white transitions between neighbour pixels, about one
+      per module along each direction,
+    - the regularity of its grid: the transitions between columns (rows)
+      projected on a line fall on the boundaries of the module columns
+      (rows), which are a module apart.
+
+  Empty parts have no ink and no edges, parts cropped across a gap between
+  codes or onto text have edges off the grid.
+*/
+
+__BCP_BEGIN_NAMESPACE
+
+
+/* Score of a part, every measure is in [0, 1] and 1 is the best */
+struct PartScore
+{
+    double ink;           // 1 for half of the pixels black, 0 below 15%
+                          // or above 85%
+    double edges;         // transitions per pixel against the number
+                          // expected for the module size found
+    double regularity;    // transitions on the grid, 0 for as many as
+                          // there would be by chance
+    int module;           // module size found, in pixels
+    double score;         // the lowest of the measures above
+
+    PartScore(void)
+        : ink(0), edges(0), regularity(0), module(0), score(0) {}
+};
+
+
+/* Transitions of a direction, projected on a line: from white to black
+   and from black to white apart. Thresholding a blurred code makes the
+   black modules grow or shrink, which moves the two kinds of transitions
+   off the grid by opposite amounts, each kind stays on a grid of its own. */
+struct __edge_projection
+{
+    std::vector<int> rising, falling;     // white (1) to black (0) and back
+
+    __edge_projection(size_type length): rising(length, 0), falling(length, 0) {}
+};
+
+// the transitions on the best grid of module m (x = phase + k*m, phase
+// picked freely), counted up to a pixel off a line
+inline int __TransitionsOnGrid(const std::vector<int> &near_line, int m)
+{
+    int best = 0;
+    for (int phase = 0; phase < m; phase++)
+    {
+        int on_grid = 0;
+        for (size_t x = phase; x < near_line.size(); x += m) {
+            on_grid += near_line[x];
+        }
+        best = std::max(best, on_grid);
+    }
+    return best;
+}
+
+/* Regularity of the transitions of a direction: the part of them on the
+   best grid, rescaled so that transitions spread at random give 0. Module
+   sizes from min_module to an eighth of the projection are tried. */
+inline double __GridRegularity(const __edge_projection &edges,
+    int min_module, int &module)
+{
+    int total = 0;
+    for (size_t i = 0; i < edges.rising.size(); i++)
+        total += edges.rising[i] + edges.falling[i];
+
+    module = 0;
+    int length = (int)edges.rising.size();
+    if (total == 0 || length < 2 * min_module)
+        return 0;
+
+    // transitions at x, x+1 or x+2: a grid line at x+1 and a pixel around it
+    std::vector<int> rising(edges.rising), falling(edges.falling);
+    __PiecewiseIntegration(rising.begin(), rising.end(), 3);
+    __PiecewiseIntegration(falling.begin(), falling.end(), 3);
+    rising.resize(length - 2), falling.resize(length - 2);
+
+    double best = 0;
+    for (int m = min_module; m <= std::max(min_module, length / 8); m++)
+    {
+        int on_grid =
+            __TransitionsOnGrid(rising, m) + __TransitionsOnGrid(falling, m);
+
+        double chance = 3.0 / m;
+        double regularity = ((double)on_grid / total - chance) / (1 - chance);
+        if (regularity > best) {
+            best = regularity, module = m;
+        }
+    }
+    return best;
+}
+
+/* Score a split part. Modules are taken to be at least min_module pixels
+   wide, below 4 pixels any transitions fall close to a grid line. */
+inline PartScore ScorePart(const Image<pixel_Monochrome> &part,
+    int min_module = 4)
+{
+    PartScore s;
+    size_type width = part.get_width(), height = part.get_height();
+    if (width < 2 || height < 2)
+        return s;
+
+    /* transitions between columns x-1 and x, projected on the x axis, and
+       between rows y-1 and y, projected on the y axis */
+    __edge_projection col_edges(width), row_edges(height);
+    int *col_rising = &col_edges.rising[0], *col_falling = &col_edges.falling[0];
+    long n_black = 0;
+    for (index_type y = 0; y < height; y++)
+    {
+        // pixels are 0 or 1, the loops are vectorized
+        const int *row = (const int*)part.row(y);
+        const int *above = (const int*)part.row(y > 0? y - 1: 0);
+
+        int n_white = 0, n_rising = 0, n_falling = 0;
+        for (index_type x = 0; x < width; x++)
+        {
+            n_white   += row[x];
+            n_rising  += above[x] & (1 - row[x]);
+            n_falling += (1 - above[x]) & row[x];
+        }
+        for (index_type x = 1; x < width; x++)
+        {
+            col_rising[x]  += row[x - 1] & (1 - row[x]);
+            col_falling[x] += (1 - row[x - 1]) & row[x];
+        }
+
+        n_black += width - n_white;
+        row_edges.rising[y] = n_rising, row_edges.falling[y] = n_falling;
+    }
+
+    double area = (double)width * height;
+    double ink = n_black / area;
+    s.ink = std::max(0.0, 1 - std::fabs(ink - 0.5) / 0.35);
+
+    // the grid, in both directions
+    int module_x = 0, module_y = 0;
+    double regularity_x = __GridRegularity(col_edges, min_module, module_x);
+    double regularity_y = __GridRegularity(row_edges, min_module, module_y);
+    s.regularity = std::min(regularity_x, regularity_y);
+    s.module = std::max(module_x, module_y);
+
+    /* random modules differ from their neighbour half of the time: about
+       1 / module transitions per pixel, half along each direction */
+    int n_edges = 0;
+    for (index_type x = 0; x < width; x++)
+        n_edges += col_edges.rising[x] + col_edges.falling[x];
+    for (index_type y = 0; y < height; y++)
+        n_edges += row_edges.rising[y] + row_edges.falling[y];
+    if (s.module > 0 && n_edges > 0)
+    {
+        double density = n_edges / area, expected = 1.0 / s.module;
+        s.edges = std::min(density, expected) / std::max(density, expected);
+    }
+
+    s.score = std::min(s.ink, std::min(s.edges, s.regularity));
+    return s;
+}
+
+
+__BCP_END_NAMESPACE
+
+
+#endif /* __BCP_PART_SCORE_HEADER__ */
@@ -0,0 +1,289 @@
+#ifndef __BCP_SYNTH_HEADER__
+#define __BCP_SYNTH_HEADER__
+
+
+#include <vector>
+#include <cmath>
+
+#include "bcp_image.hpp"
+#include "bcp_extract.hpp"
+
+/*
+  Synthetic invoice generator. It renders an invoice-sized page with a row of
+  2D-code-like blocks in the placeholder box, at the place Extract2DCodes()
+  expects them, together with the things which make real scans hard: tilt,
+  box borders running into the codes, noise, blur and uneven lighting.
+
+  The ground truth of the code location is reported in the same terms as
+  the result of Extract2DCodes(), so the two can be compared directly.
+*/
+
+__BCP_BEGIN_NAMESPACE
+
+
+/* A linear congruential generator, pages rendered with the same seed are
+   always the same. */
+class SynthRandom
+{
+public:
+    SynthRandom(unsigned int seed = 1): state(seed) {}
+
+    // 24 random bits
+    unsigned int next(void) {
+        state = state * 1103515245u + 12345u;
+        return (state >> 8) & 0xffffff;
+    }
+
+    // uniformly distributed integer in [lo, hi]
+    int range(int lo, int hi) {
+        return lo + (int)(next() % (unsigned int)(hi - lo + 1));
+    }
+
+    // uniformly distributed real number in [lo, hi)
+    double uniform(double lo, double hi) {
+        return lo + (hi - lo) * (next() / 16777216.0);
+    }
+
+    // normally distributed real number (Box-Muller)
+    double gaussian(double sigma) {
+        double u1 = (next() + 1) / 16777217.0, u2 = next() / 16777216.0;
+        return sigma * std::sqrt(-2 * std::log(u1)) * std::cos(6.283185307 * u2);
+    }
+
+private:
+    unsigned int state;
+};
+
+
+/* Parameters of a synthetic invoice */
+struct SyntheticInvoice
+{
+    size_type page_width, page_height;   // size of the page
+
+    double tilt;              // slope (dy/dx) of the code row
+    index_type shift_x;       // shift of the code row from its usual place
+    index_type shift_y;
+    int border_overlap;       // how far the box border runs into the codes
+    double noise;             // standard deviation of the pixel noise
+    int blur;                 // radius of the box blur, 0 for a sharp page
+    double gradient;          // lighting falloff across the page, 0..1
+    unsigned int seed;        // seed for the codes, text and noise
+    InvoiceLayout layout;     // where the codes are printed
+
+    SyntheticInvoice(void)
+        : page_width(2835), page_height(1654),
+          tilt(0), shift_x(0), shift_y(0), border_overlap(0),
+          noise(8), blur(0), gradient(0), seed(1), layout() {}
+};
+
+/* Where the codes really are, in the terms of __2Dcode_Extraction: y0 and
+   tilt as returned by Locate2DCode on the roughly cropped target box, left
+   is the horizontal position of the first code after tilt calibration. */
+struct __Synth_Truth
+{
+    double tilt;
+    index_type y0;
+    index_type left;
+};
+
+
+// usual position of the first code in the roughly cropped target box
+const index_type __synth_code_x = 120, __synth_code_y = 100;
+
+const int __synth_module = 6;            // size of a code module in px
+const int __synth_paper = 235, __synth_ink = 20;   // paper and ink intensity
+
+
+/* Draw a 2D-code-like pattern of code_size x code_size px on `modules':
+   random modules with QR-style finder patterns in three corners. */
+inline void __synth_code_modules(
+    SynthRandom &rnd, std::vector<unsigned char> &modules, int n)
+{
+    modules.resize(n * n);
+    for (int i = 0; i < n * n; i++) {
+        modules[i] = (unsigned char)(rnd.next() & 1);
+    }
+
+    // finder patterns: 7x7 ring with a 3x3 core, plus a white separator
+    const int corner_x[3] = {0, n - 7, 0}, corner_y[3] = {0, 0, n - 7};
+    for (int c = 0; c < 3; c++)
+    {
+        for (int j = -1; j <= 7; j++)
+        {
+            for (int i = -1; i <= 7; i++)
+            {
+                int mx = corner_x[c] + i, my = corner_y[c] + j;
+                if (mx < 0 || mx >= n || my < 0 || my >= n) continue;
+
+                bool ring = (i == 0 || i == 6 || j == 0 || j == 6) &&
+                    i >= 0 && i <= 6 && j >= 0 && j <= 6;
+                bool core = i >= 2 && i <= 4 && j >= 2 && j <= 4;
+                modules[my * n + mx] = (ring || core)? 1: 0;
+            }
+        }
+    }
+}
+
+/* Separable box blur of the given radius on an intensity plane */
+inline void __synth_box_blur(
+    std::vector<float> &plane, size_type width, size_type height, int radius)
+{
+    std::vector<float> line;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        // pass 0 blurs the rows, pass 1 blurs the columns
+        size_type n_lines = pass? width: height, len = pass? height: width;
+        size_type step = pass? width: 1, stride = pass? 1: width;
+
+        line.resize(len);
+        for (index_type l = 0; l < n_lines; l++)
+        {
+            float *p = &plane[l * stride];
+            for (index_type i = 0; i < len; i++) line[i] = p[i * step];
+
+            float sum = 0;
+            int n = 0;
+            for (index_type i = 0; i < radius && i < len; i++, n++) sum += line[i];
+            for (index_type i = 0; i < len; i++)
+            {
+                if (i + radius < len)      { sum += line[i + radius]; n++; }
+                if (i - radius - 1 >= 0)   { sum -= line[i - radius - 1]; n--; }
+                p[i * step] = sum / n;
+            }
+        }
+    }
+}
+
+
+/* Render a synthetic invoice to `page' and report where the codes are */
+inline void RenderSyntheticInvoice(
+    const SyntheticInvoice &inv, Image<> &page, __Synth_Truth &truth)
+{
+    const size_type width = inv.page_width, height = inv.page_height;
+    const InvoiceLayout &l = inv.layout;
+    SynthRandom rnd(inv.seed);
+    std::vector<float> plane(width * height, (float)__synth_paper);
+
+    // some lines of "text" all over the page except the placeholder box
+    for (index_type ty = 80; ty + 30 < height; ty += 60)
+    {
+        for (index_type tx = 80; tx + 30 < width; )
+        {
+            index_type word = rnd.range(40, 200);
+            bool in_box =
+                tx + word > l.target_x0 - 60 &&
+                tx < l.target_x0 + l.target_width + 60 &&
+                ty + 30 > l.target_y0 - 60 &&
+                ty < l.target_y0 + l.target_height + 60;
+
+            if (!in_box && (rnd.next() & 3))
+            {
+                for (index_type y = ty; y < ty + 24; y++)
+                {
+                    for (index_type x = tx; x < tx + word && x < width; x++) {
+                        if (((x - tx) % 14) < 9 && ((y - ty) % 24) < 20)
+                            plane[y * width + x] = (float)__synth_ink;
+                    }
+                }
+            }
+            tx += word + rnd.range(20, 60);
+        }
+    }
+
+    // the codes: rotate each pixel of the box back to the code row
+    const double theta = std::atan(inv.tilt);
+    const double cos_t = std::cos(theta), sin_t = std::sin(theta);
+    const int n_modules = l.code_size / __synth_module;
+
+    const index_type
+        anchor_x = l.target_x0 + __synth_code_x + inv.shift_x,
+        anchor_y = l.target_y0 + __synth_code_y + inv.shift_y;
+
+    std::vector< std::vector<unsigned char> > codes(l.n_codes);
+    for (int c = 0; c < l.n_codes; c++) {
+        __synth_code_modules(rnd, codes[c], n_modules);
+    }
+
+    const int row_len = l.n_codes * (l.code_size + l.code_padding);
+    for (index_type y = anchor_y - row_len; y < anchor_y + row_len; y++)
+    {
+        if (y < 0 || y >= height) continue;
+        for (index_type x = anchor_x - 16; x < anchor_x + row_len; x++)
+        {
+            if (x < 0 || x >= width) continue;
+
+            double dx = x - anchor_x, dy = y - anchor_y;
+            double u = dx * cos_t + dy * sin_t, v = -dx * sin_t + dy * cos_t;
+            if (u < 0 || v < 0 || v >= l.code_size) continue;
+
+            int c = (int)(u / (l.code_size + l.code_padding));
+            double cu = u - c * (l.code_size + l.code_padding);
+            if (c >= l.n_codes || cu >= l.code_size) continue;
+
+            int mx = (int)cu / __synth_module, my = (int)v / __synth_module;
+            if (mx < n_modules && my < n_modules &&
+                codes[c][my * n_modules + mx])
+            {
+                plane[y * width + x] = (float)__synth_ink;
+            }
+        }
+    }
+
+    /* the placeholder box, a border of 4px placed 14px away from the usual
+       position of the code row, or closer when we want them to overlap. */
+    const int gap = 14 - inv.border_overlap;
+    const index_type
+        box_left   = l.target_x0 + __synth_code_x - 60,
+        box_right  = l.target_x0 + l.target_width - 20,
+        box_top    = l.target_y0 + __synth_code_y - gap - 4,
+        box_bottom = l.target_y0 + __synth_code_y + l.code_size + gap;
+
+    for (index_type x = box_left; x <= box_right; x++)
+    {
+        for (index_type t = 0; t < 4; t++) {
+            plane[(box_top + t) * width + x]    = (float)__synth_ink;
+            plane[(box_bottom + t) * width + x] = (float)__synth_ink;
+        }
+    }
+    for (index_type y = box_top; y < box_bottom + 4; y++)
+    {
+        for (index_type t = 0; t < 4; t++) {
+            plane[y * width + box_left + t]  = (float)__synth_ink;
+            plane[y * width + box_right - t] = (float)__synth_ink;
+        }
+    }
+
+    // optics and sensor: blur, lighting and noise
+    if (inv.blur > 0)
+        __synth_box_blur(plane, width, height, inv.blur);
+
+    page = Image<>(width, height);
+    for (index_type y = 0; y < height; y++)
+    {
+        for (index_type x = 0; x < width; x++)
+        {
+            double light = 1 - inv.gradient * 0.5 *
+                ((double)x / width + (double)y / height);
+            double val = plane[y * width + x] * light;
+            if (inv.noise > 0) val += rnd.gaussian(inv.noise);
+
+            int v = (int)(val + 0.5);
+            v = v < 0? 0: (v > 255? 255: v);
+            page(x,y) = pixel_RGB((byte)v, (byte)v, (byte)v);
+        }
+    }
+
+    /* ground truth: the code row runs along y = y0 + tilt*x in the cropped
+       target box, and after rotating by atan(tilt) around the corner of the
+       box the first code starts at `left'. */
+    double ax = anchor_x - l.target_x0, ay = anchor_y - l.target_y0;
+    truth.tilt = inv.tilt;
+    truth.y0   = (index_type)std::floor(ay - ax * inv.tilt + 0.5);
+    truth.left = (index_type)std::floor(ax * cos_t + ay * sin_t + 0.5);
+}
+
+
+__BCP_END_NAMESPACE
+
+
+#endif /* __BCP_SYNTH_HEADER__ */
@@ -0,0 +1,756 @@
+/*
+  Micro and macro benchmarks for the bcp library.
+
+  Each benchmark runs its operation repeatedly for a while and reports the
+  median time per operation, results are written to stdout as CSV:
+
+      name,iterations,ns_per_op,ops_per_sec
+
+  preceded by a comment line telling which pixel kernels are in use and how
+  many threads the whole-image operations run on (--threads).
+
+  Pass a previous result file with --baseline to compare against it, any
+  benchmark which became slower than the tolerance allows is reported as a
+  regression and the program exits with status 1.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+
+#include "bcp_image.hpp"
+#include "ppm_io.hpp"
+#include "bcp_extract.hpp"
+#include "bcp_cache.hpp"
+#include "bcp_synth.hpp"
+
+
+// geometry of the synthetic pages
+typedef bcp::DefaultInvoiceLayout default_layout;
+
+/* Options given on the command line */
+struct bench_options
+{
+    std::string filter;      // only run benchmarks whose name contains this
+    std::string baseline;    // result file of a previous run
+    double min_time;         // seconds spent on each benchmark
+    double tolerance;        // allowed slow down before reporting regression
+    int threads;             // threads used by the whole-image operations
+};
+
+/* Result of a single benchmark */
+struct bench_result
+{
+    std::string name;
+    long iterations;
+    double ns_per_op;
+};
+
+/* Something the optimizer cannot see through, operation results are folded
+   into it so that they won't be thrown away. */
+static volatile long bench_sink = 0;
+
+/* Execution policy of the whole-image operations being measured */
+static const bcp::ExecutionPolicy *bench_exec = &bcp::SerialPolicy();
+
+
+/* Base class of all benchmarks, setup() is called once before timing and
+   run() is the operation being measured. */
+class benchmark
+{
+public:
+    benchmark(const char *bench_name): name(bench_name) {}
+    virtual ~benchmark(void) {}
+
+    virtual void setup(void) {}
+    virtual void run(void) = 0;
+
+    std::string name;
+};
+
+
+static double now_ns(void)
+{
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Time a benchmark: find out how many iterations fit in a time slice, then
+   take several samples and keep the median of them. */
+static bench_result run_benchmark(benchmark &b, double min_time)
+{
+    const int n_samples = 5;
+    double slice_ns = min_time * 1e9 / n_samples;
+
+    b.setup();
+    b.run();   // warm up
+
+    // calibrate the number of iterations in a sample
+    long n_iter = 1;
+    for (;;)
+    {
+        double t0 = now_ns();
+        for (long i = 0; i < n_iter; i++) b.run();
+        double elapsed = now_ns() - t0;
+
+        if (elapsed >= slice_ns / 4 || n_iter >= (1L << 30)) {
+            n_iter = std::max(1L, (long)(n_iter * (slice_ns / (elapsed + 1))));
+            break;
+        }
+        n_iter *= 4;
+    }
+
+    std::vector<double> samples;
+    for (int s = 0; s < n_samples; s++)
+    {
+        double t0 = now_ns();
+        for (long i = 0; i < n_iter; i++) b.run();
+        samples.push_back((now_ns() - t0) / n_iter);
+    }
+    std::sort(samples.begin(), samples.end());
+
+    bench_result res;
+    res.name       = b.name;
+    res.iterations = n_iter * n_samples;
+    res.ns_per_op  = samples[n_samples / 2];
+    return res;
+}
+
+
+/* Render the synthetic invoice used by the benchmarks */
+static bcp::Image<> make_page(unsigned int seed)
+{
+    bcp::SyntheticInvoice inv;
+    inv.tilt = 0.01;
+    inv.border_overlap = 8;
+    inv.seed = seed;
+
+    bcp::Image<> page;
+    bcp::__Synth_Truth truth;
+    bcp::RenderSyntheticInvoice(inv, page, truth);
+    return page;
+}
+
+/* Target box of a page, roughly cropped like what Extract2DCodes does */
+static bcp::Image<> crop_target(const bcp::Image<> &page)
+{
+    return page.crop(
+        default_layout::target_x0,
+        default_layout::target_x0 + default_layout::target_width,
+        default_layout::target_y0,
+        default_layout::target_y0 + default_layout::target_height);
+}
+
+static std::string temp_filename(const char *tag)
+{
+    std::ostringstream name;
+    const char *dir = getenv("TMPDIR");
+    name << (dir? dir: "/tmp") << "/bcp_bench_" << getpid() << "_" << tag;
+    return name.str();
+}
+
+
+/* ---------------------------------------------------------------------------
+   Benchmarks
+   --------------------------------------------------------------------------- */
+
+/* Benchmarks working on the roughly cropped target box */
+class roi_benchmark: public benchmark
+{
+public:
+    roi_benchmark(const char *name): benchmark(name) {}
+
+    void setup(void) {
+        rgb  = crop_target(make_page(1));
+        mono = rgb.threshold();
+    }
+
+protected:
+    bcp::Image<> rgb;
+    bcp::Image<bcp::pixel_Monochrome> mono;
+};
+
+class bench_convert_gray: public roi_benchmark
+{
+public:
+    bench_convert_gray(void): roi_benchmark("ConvertImage/RGB-Grayscale") {}
+    void run(void) {
+        bcp::Image<bcp::pixel_Grayscale> g =
+            bcp::ConvertImage(rgb, bcp::Image<bcp::pixel_Grayscale>(), *bench_exec);
+        bench_sink += g(0,0).val;
+    }
+};
+
+class bench_convert_rgb: public roi_benchmark
+{
+public:
+    bench_convert_rgb(void): roi_benchmark("ConvertImage/Monochrome-RGB") {}
+    void run(void) {
+        bcp::Image<> c = bcp::ConvertImage(mono, bcp::Image<>(), *bench_exec);
+        bench_sink += c(0,0).r;
+    }
+};
+
+class bench_threshold: public roi_benchmark
+{
+public:
+    bench_threshold(void): roi_benchmark("ThresholdImage/RGB") {}
+    void run(void) {
+        bcp::Image<bcp::pixel_Monochrome> m = bcp::ThresholdImage(rgb, 128, *bench_exec);
+        bench_sink += m(0,0).val;
+    }
+};
+
+class bench_otsu: public roi_benchmark
+{
+public:
+    bench_otsu(void): roi_benchmark("OtsuThresholdSelector/RGB") {}
+    void run(void) {
+        bench_sink += bcp::OtsuThresholdSelector(rgb, *bench_exec);
+    }
+};
+
+/* The same on the compact and planar layouts of the target box */
+class layout_benchmark: public roi_benchmark
+{
+public:
+    layout_benchmark(const char *name): roi_benchmark(name) {}
+
+    void setup(void) {
+        roi_benchmark::setup();
+        gray8 = bcp::ConvertImage(rgb, bcp::Image<bcp::pixel_Gray8>());
+        planar = bcp::PlanarImage(rgb);
+    }
+
+protected:
+    bcp::Image<bcp::pixel_Gray8> gray8;
+    bcp::PlanarImage planar;
+};
+
+class bench_convert_planar: public layout_benchmark
+{
+public:
+    bench_convert_planar(void): layout_benchmark("ConvertImage/Planar-Gray8") {}
+    void run(void) {
+        bcp::Image<bcp::pixel_Gray8> g =
+            bcp::ConvertImage(planar, bcp::Image<bcp::pixel_Gray8>(), *bench_exec);
+        bench_sink += g(0,0).val;
+    }
+};
+
+class bench_threshold_gray8: public layout_benchmark
+{
+public:
+    bench_threshold_gray8(void): layout_benchmark("ThresholdImage/Gray8") {}
+    void run(void) {
+        bcp::Image<bcp::pixel_Monochrome> m = bcp::ThresholdImage(gray8, 128, *bench_exec);
+        bench_sink += m(0,0).val;
+    }
+};
+
+class bench_otsu_gray8: public layout_benchmark
+{
+public:
+    bench_otsu_gray8(void): layout_benchmark("OtsuThresholdSelector/Gray8") {}
+    void run(void) {
+        bench_sink += bcp::OtsuThresholdSelector(gray8, *bench_exec);
+    }
+};
+
+class bench_otsu_planar: public layout_benchmark
+{
+public:
+    bench_otsu_planar(void): layout_benchmark("OtsuThresholdSelector/Planar") {}
+    void run(void) {
+        bench_sink += bcp::OtsuThresholdSelector(planar, *bench_exec);
+    }
+};
+
+class bench_ray: public roi_benchmark
+{
+public:
+    bench_ray(void): roi_benchmark("RayDetection/Monochrome") {}
+    void run(void) {
+        bench_sink += bcp::RayDetection(mono, 0.01, 100);
+    }
+};
+
+class bench_tomography: public roi_benchmark
+{
+public:
+    bench_tomography(void): roi_benchmark("TomographyProjection/Monochrome") {}
+    void run(void) {
+        bcp::TomographyProjection(mono, 0.01, tomo_array);
+        bench_sink += tomo_array[0];
+    }
+
+private:
+    std::vector<int> tomo_array;
+};
+
+class bench_integration: public benchmark
+{
+public:
+    bench_integration(void): benchmark("__PiecewiseIntegration") {}
+
+    void setup(void) {
+        bcp::SynthRandom rnd(2);
+        source.resize(default_layout::target_height + 1);
+        for (size_t i = 0; i < source.size(); i++) {
+            source[i] = rnd.range(0, default_layout::target_width);
+        }
+    }
+    void run(void) {
+        work = source;
+        bcp::__PiecewiseIntegration(
+            work.begin(), work.end(), default_layout::code_size);
+        bench_sink += work[0];
+    }
+
+private:
+    std::vector<int> source, work;
+};
+
+class bench_rotate: public roi_benchmark
+{
+public:
+    bench_rotate(void): roi_benchmark("RotateImage/Monochrome") {}
+    void run(void) {
+        bcp::Image<bcp::pixel_Monochrome> r =
+            bcp::RotateImage(mono, 0.01, 0, 0, *bench_exec);
+        bench_sink += r(0,0).val;
+    }
+};
+
+class bench_transpose: public roi_benchmark
+{
+public:
+    bench_transpose(void): roi_benchmark("TransposeImage/Monochrome") {}
+    void run(void) {
+        bcp::Image<bcp::pixel_Monochrome> t =
+            bcp::TransposeImage(mono, *bench_exec);
+        bench_sink += t(0,0).val;
+    }
+};
+
+class bench_locate: public roi_benchmark
+{
+public:
+    bench_locate(void): roi_benchmark("Locate2DCode") {}
+    void run(void) {
+        bcp::__2Dcode_Location loc = bcp::Locate2DCode(
+            mono, default_layout::max_oblique, default_layout::code_size);
+        bench_sink += loc.y0;
+    }
+};
+
+/* Locate2DCode on the next page of a steady source: the prior already holds
+   the location of the same page */
+class bench_locate_warm: public roi_benchmark
+{
+public:
+    bench_locate_warm(void): roi_benchmark("Locate2DCode/warm") {}
+
+    void setup(void) {
+        roi_benchmark::setup();
+        prior.reset();
+        bcp::Locate2DCode(mono, default_layout::max_oblique,
+            default_layout::code_size, prior);
+    }
+    void run(void) {
+        bcp::__2Dcode_Location loc = bcp::Locate2DCode(mono,
+            default_layout::max_oblique, default_layout::code_size, prior);
+        bench_sink += loc.y0;
+    }
+
+private:
+    bcp::LocationPrior prior;
+};
+
+/* Removal of the box border and the speckle off the thresholded box */
+class bench_clean: public roi_benchmark
+{
+public:
+    bench_clean(void): roi_benchmark("CleanMonochrome/box") {}
+    void run(void) {
+        bcp::Image<bcp::pixel_Monochrome> m = mono;
+        bcp::CleanMonochrome(m, default_layout::code_size, 5, 1);
+        bench_sink += m(0,0).val;
+    }
+};
+
+/* Code-likeness of a split part */
+class bench_score: public benchmark
+{
+public:
+    bench_score(void): benchmark("ScorePart/part") {}
+
+    void setup(void) {
+        bcp::Image<> page = make_page(1);
+        bcp::__2Dcode_Extraction ext;
+        bcp::Extract2DCodes(page, ext);
+        part = ext.parts[0];
+    }
+    void run(void) {
+        bench_sink += (int)(bcp::ScorePart(part).score * 100);
+    }
+
+private:
+    bcp::Image<bcp::pixel_Monochrome> part;
+};
+
+/* Coarse localization of the code row, 300 px around the target box */
+class bench_locate_box: public benchmark
+{
+public:
+    bench_locate_box(void): benchmark("LocateTargetBox/page") {}
+
+    void setup(void) {
+        page = make_page(1);
+    }
+    void run(void) {
+        bcp::index_type x0 = default_layout::target_x0,
+                        y0 = default_layout::target_y0;
+        bcp::LocateTargetBox(page, default_layout(), 300, x0, y0, *bench_exec);
+        bench_sink += x0 + y0;
+    }
+
+private:
+    bcp::Image<> page;
+};
+
+class bench_ppm_load: public benchmark
+{
+public:
+    bench_ppm_load(void): benchmark("LoadPPMImage/page") {}
+
+    void setup(void) {
+        filename = temp_filename("load.ppm");
+        make_page(1).save_ppm(filename.c_str());
+    }
+    void run(void) {
+        bcp::Image<> img(filename.c_str());
+        bench_sink += img(0,0).r;
+    }
+    ~bench_ppm_load(void) {
+        if (!filename.empty()) unlink(filename.c_str());
+    }
+
+private:
+    std::string filename;
+};
+
+class bench_ppm_save: public roi_benchmark
+{
+public:
+    bench_ppm_save(void): roi_benchmark("SavePPM6Image/Monochrome") {}
+
+    void setup(void) {
+        roi_benchmark::setup();
+        filename = temp_filename("save.ppm");
+    }
+    void run(void) {
+        mono.save_ppm(filename.c_str());
+    }
+    ~bench_ppm_save(void) {
+        if (!filename.empty()) unlink(filename.c_str());
+    }
+
+private:
+    std::string filename;
+};
+
+/* Saving through AsyncFileIO: the time left on the calling thread, the
+   files are written in the background and waited for a batch at a time */
+class bench_ppm_save_async: public roi_benchmark
+{
+public:
+    bench_ppm_save_async(void)
+        : roi_benchmark("SavePPM6Image/Monochrome-async"), n_saved(0) {}
+
+    void setup(void)
+    {
+        roi_benchmark::setup();
+        io = bcp::OpenAsyncFileIO();
+        for (size_t i = 0; i < bcp::AsyncFileIO::write_batch; i++)
+        {
+            std::ostringstream name;
+            name << "save_async_" << i << ".ppm";
+            filenames.push_back(temp_filename(name.str().c_str()));
+        }
+    }
+    void run(void)
+    {
+        mono.save_ppm(*io, filenames[n_saved % filenames.size()].c_str());
+        if (++n_saved % filenames.size() == 0)
+            io->flush();
+    }
+    ~bench_ppm_save_async(void)
+    {
+        if (io) io->flush();
+        for (size_t i = 0; i < filenames.size(); i++)
+            unlink(filenames[i].c_str());
+    }
+
+private:
+    std::unique_ptr<bcp::AsyncFileIO> io;
+    std::vector<std::string> filenames;
+    size_t n_saved;
+};
+
+/* A page found in the result cache: hashing it and reading its result back,
+   what's left of the extraction for a page submitted again */
+class bench_cache_hit: public benchmark
+{
+public:
+    bench_cache_hit(void): benchmark("ResultCache/hit") {}
+
+    void setup(void)
+    {
+        dir = temp_filename("cache");
+        cache.reset(new bcp::ResultCache(dir.c_str()));
+        page = make_page(1);
+
+        bcp::__2Dcode_Extraction ext;
+        bcp::Extract2DCodes(page, ext, *bench_exec);
+        cache->store(bcp::MakeCacheKey(page, layout), ext);
+    }
+    void run(void)
+    {
+        bcp::__2Dcode_Extraction ext;
+        cache->lookup(bcp::MakeCacheKey(page, layout), ext);
+        bench_sink += ext.left;
+    }
+    ~bench_cache_hit(void)
+    {
+        cache.reset();
+        if (dir.empty())
+            return;
+
+        DIR *d = opendir(dir.c_str());
+        for (struct dirent *f; d != NULL && (f = readdir(d)) != NULL; )
+        {
+            if (f->d_name[0] != '.')
+                unlink((dir + "/" + f->d_name).c_str());
+        }
+        if (d != NULL) closedir(d);
+        rmdir(dir.c_str());
+    }
+
+private:
+    std::string dir;
+    std::unique_ptr<bcp::ResultCache> cache;
+    bcp::Image<> page;
+    bcp::InvoiceLayout layout;
+};
+
+/* End to end: load an invoice, extract the 2D codes and save all of them,
+   ops_per_sec of this benchmark is the number of pages per second. */
+class bench_pages: public benchmark
+{
+public:
+    bench_pages(void): benchmark("EndToEnd/pages") {}
+
+    void setup(void) {
+        filename = temp_filename("page.ppm");
+        make_page(1).save_ppm(filename.c_str());
+    }
+    void run(void)
+    {
+        bcp::Image<> img(filename.c_str());
+        bcp::__2Dcode_Extraction ext;
+        bcp::Extract2DCodes(img, ext, *bench_exec);
+
+        std::string out = temp_filename("out.ppm");
+        ext.thresholded.save_ppm(out.c_str());
+        for (size_t i = 0; i < ext.parts.size(); i++) {
+            ext.parts[i].save_ppm(out.c_str());
+        }
+        unlink(out.c_str());
+
+        bench_sink += ext.left;
+    }
+    ~bench_pages(void) {
+        if (!filename.empty()) unlink(filename.c_str());
+    }
+
+private:
+    std::string filename;
+};
+
+
+/* ---------------------------------------------------------------------------
+   Baseline comparison
+   --------------------------------------------------------------------------- */
+
+/* Read ns_per_op of each benchmark from a result file written by us */
+static std::map<std::string, double> load_baseline(const std::string &filename)
+{
+    std::map<std::string, double> baseline;
+    std::ifstream in(filename.c_str());
+    if (!in) throw bcp::cannot_open_file(filename.c_str());
+
+    std::string line;
+    while (std::getline(in, line))
+    {
+        if (line.empty() || line[0] == '#' || line.compare(0, 5, "name,") == 0)
+            continue;
+
+        std::istringstream fields(line);
+        std::string name, iterations, ns_per_op;
+        std::getline(fields, name, ',');
+        std::getline(fields, iterations, ',');
+        std::getline(fields, ns_per_op, ',');
+        baseline[name] = atof(ns_per_op.c_str());
+    }
+
+    return baseline;
+}
+
+/* Print the comparison to stderr, return the number of regressions */
+static int compare_baseline(
+    const std::vector<bench_result> &results,
+    const std::map<std::string, double> &baseline, double tolerance)
+{
+    int n_regressions = 0;
+    fprintf(stderr, "%-36s %14s %14s %8s\n",
+        "benchmark", "baseline(ns)", "current(ns)", "ratio");
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        std::map<std::string, double>::const_iterator itr =
+            baseline.find(results[i].name);
+        if (itr == baseline.end() || itr->second <= 0) {
+            fprintf(stderr, "%-36s %14s %14.0f %8s\n", results[i].name.c_str(),
+                "-", results[i].ns_per_op, "new");
+            continue;
+        }
+
+        double ratio = results[i].ns_per_op / itr->second;
+        const char *verdict = "";
+        if (ratio > 1 + tolerance) {
+            verdict = "REGRESSION"; n_regressions++;
+        }
+        else if (ratio < 1 - tolerance) {
+            verdict = "improved";
+        }
+
+        fprintf(stderr, "%-36s %14.0f %14.0f %8.3f %s\n",
+            results[i].name.c_str(), itr->second, results[i].ns_per_op,
+            ratio, verdict);
+    }
+
+    return n_regressions;
+}
+
+
+static void usage(const char *prog)
+{
+    std::cerr << "usage: " << prog
+              << " [--filter substr] [--min-time sec]"
+              << " [--baseline file] [--tolerance ratio] [--threads n]"
+              << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    bench_options opt;
+    opt.min_time  = 0.5;
+    opt.tolerance = 0.10;
+    opt.threads   = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--filter")          opt.filter = argv[++i];
+        else if (i + 1 < argc && arg == "--baseline")   opt.baseline = argv[++i];
+        else if (i + 1 < argc && arg == "--min-time")   opt.min_time = atof(argv[++i]);
+        else if (i + 1 < argc && arg == "--tolerance")  opt.tolerance = atof(argv[++i]);
+        else if (i + 1 < argc && arg == "--threads")    opt.threads = atoi(argv[++i]);
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    bcp::ThreadPoolExecution pool(opt.threads);
+    bench_exec = &pool;
+
+    std::vector<benchmark*> benchmarks;
+    benchmarks.push_back(new bench_convert_gray);
+    benchmarks.push_back(new bench_convert_rgb);
+    benchmarks.push_back(new bench_threshold);
+    benchmarks.push_back(new bench_otsu);
+    benchmarks.push_back(new bench_convert_planar);
+    benchmarks.push_back(new bench_threshold_gray8);
+    benchmarks.push_back(new bench_otsu_gray8);
+    benchmarks.push_back(new bench_otsu_planar);
+    benchmarks.push_back(new bench_ray);
+    benchmarks.push_back(new bench_tomography);
+    benchmarks.push_back(new bench_integration);
+    benchmarks.push_back(new bench_rotate);
+    benchmarks.push_back(new bench_transpose);
+    benchmarks.push_back(new bench_locate);
+    benchmarks.push_back(new bench_locate_warm);
+    benchmarks.push_back(new bench_locate_box);
+    benchmarks.push_back(new bench_clean);
+    benchmarks.push_back(new bench_score);
+    benchmarks.push_back(new bench_ppm_load);
+    benchmarks.push_back(new bench_ppm_save);
+    benchmarks.push_back(new bench_ppm_save_async);
+    benchmarks.push_back(new bench_cache_hit);
+    benchmarks.push_back(new bench_pages);
+
+    int status = 0;
+    try
+    {
+        std::map<std::string, double> baseline;
+        if (!opt.baseline.empty())
+            baseline = load_baseline(opt.baseline);
+
+        std::vector<bench_result> results;
+        std::cout << "# kernels: " << bcp::PixelKernels().name
+                  << ", threads: " << pool.concurrency() << std::endl;
+        std::cout << "name,iterations,ns_per_op,ops_per_sec" << std::endl;
+
+        for (size_t i = 0; i < benchmarks.size(); i++)
+        {
+            if (benchmarks[i]->name.find(opt.filter) == std::string::npos)
+                continue;
+
+            bench_result res = run_benchmark(*benchmarks[i], opt.min_time);
+            results.push_back(res);
+
+            printf("%s,%ld,%.1f,%.3f\n", res.name.c_str(), res.iterations,
+                res.ns_per_op, 1e9 / res.ns_per_op);
+            fflush(stdout);
+        }
+
+        if (!opt.baseline.empty() &&
+            compare_baseline(results, baseline, opt.tolerance) > 0)
+        {
+            status = 1;
+        }
+    }
+    catch (bcp::exception &e) {
+        std::cerr << e.message() << std::endl;
+        status = 2;
+    }
+
+    for (size_t i = 0; i < benchmarks.size(); i++)
+        delete benchmarks[i];
+
+    return status;
+}
@@ -0,0 +1,292 @@
+/*
+  Generate synthetic invoices for load and accuracy testing, or check how
+  accurate the extraction is on a set of generated invoices.
+
+      geninvoice [options] output_dir
+      geninvoice --verify output_dir/truth.csv
+
+  Generated pages are written as output_dir/invoice_NNNNN.ppm, ground truth
+  of each page goes to output_dir/truth.csv.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include "bcp_image.hpp"
+#include "ppm_io.hpp"
+#include "bcp_extract.hpp"
+#include "bcp_synth.hpp"
+
+
+/* Ranges of the page parameters, each page picks its own parameters
+   uniformly from these ranges. */
+struct gen_options
+{
+    int count;
+    unsigned int seed;
+    double max_tilt;        // degrees
+    int max_shift;          // px
+    int max_overlap;        // px
+    double max_noise;
+    int max_blur;
+    double max_gradient;
+    bool feeder;            // pages from a scanner feeder: the tilt and
+                            // shift drift slowly from page to page
+};
+
+
+static int generate(const gen_options &opt, const std::string &dir)
+{
+    std::string truth_name = dir + "/truth.csv";
+    FILE *truth = fopen(truth_name.c_str(), "w");
+    if (truth == NULL)
+        throw bcp::cannot_open_file(truth_name.c_str());
+
+    fprintf(truth,
+        "file,tilt,y0,left,shift_x,shift_y,overlap,noise,blur,gradient,seed\n");
+
+    bcp::SynthRandom rnd(opt.seed);
+    double tilt_deg = rnd.uniform(-opt.max_tilt, opt.max_tilt);
+    int shift_x = rnd.range(-opt.max_shift, opt.max_shift);
+    int shift_y = rnd.range(-opt.max_shift, opt.max_shift);
+
+    for (int i = 0; i < opt.count; i++)
+    {
+        if (!opt.feeder) {
+            tilt_deg = rnd.uniform(-opt.max_tilt, opt.max_tilt);
+            shift_x = rnd.range(-opt.max_shift, opt.max_shift);
+            shift_y = rnd.range(-opt.max_shift, opt.max_shift);
+        }
+        else if (i > 0) {
+            tilt_deg = std::max(-opt.max_tilt, std::min(opt.max_tilt,
+                tilt_deg + rnd.uniform(-0.05, 0.05)));
+            shift_x = std::max(-opt.max_shift,
+                std::min(opt.max_shift, shift_x + rnd.range(-1, 1)));
+            shift_y = std::max(-opt.max_shift,
+                std::min(opt.max_shift, shift_y + rnd.range(-1, 1)));
+        }
+
+        bcp::SyntheticInvoice inv;
+        inv.tilt = tan(tilt_deg * M_PI / 180);
+        inv.shift_x = shift_x;
+        inv.shift_y = shift_y;
+        inv.border_overlap = rnd.range(0, opt.max_overlap);
+        inv.noise    = rnd.uniform(0, opt.max_noise);
+        inv.blur     = rnd.range(0, opt.max_blur);
+        inv.gradient = rnd.uniform(0, opt.max_gradient);
+        inv.seed     = rnd.next();
+
+        bcp::Image<> page;
+        bcp::__Synth_Truth t;
+        bcp::RenderSyntheticInvoice(inv, page, t);
+
+        char name[32];
+        sprintf(name, "invoice_%05d.ppm", i);
+        page.save_ppm((dir + "/" + name).c_str());
+
+        fprintf(truth, "%s,%.6f,%d,%d,%d,%d,%d,%.2f,%d,%.3f,%u\n",
+            name, t.tilt, t.y0, t.left, inv.shift_x, inv.shift_y,
+            inv.border_overlap, inv.noise, inv.blur, inv.gradient, inv.seed);
+    }
+
+    fclose(truth);
+    return 0;
+}
+
+
+/* Run Extract2DCodes() on every page listed in the truth file and compare
+   the result with the truth. A page passes when the code row is found
+   within `tolerance' px, both vertically and horizontally, and the tilt
+   error over the width of the target box is within `tolerance' px too.
+   Time spent on each page (loading included) is reported as well. With
+   `warm', the pages are taken as coming from the same source and the tilt
+   search of a page starts from the previous one. With a search margin, the
+   target box is moved onto the codes found around it, and the truth is
+   taken relative to where the box was moved. The thresholded box is cleaned
+   as the limits say. */
+static int verify(const std::string &truth_name, int tolerance, bool warm,
+    const bcp::ExtractionLimits &limits)
+{
+    std::ifstream in(truth_name.c_str());
+    if (!in) throw bcp::cannot_open_file(truth_name.c_str());
+
+    std::string dir = ".";
+    if (truth_name.find('/') != std::string::npos)
+        dir = truth_name.substr(0, truth_name.rfind('/'));
+
+    int n_pages = 0, n_passed = 0, n_rejected = 0;
+    double sum_dy = 0, sum_dleft = 0, sum_dtilt = 0;
+    int max_dy = 0, max_dleft = 0;
+    std::vector<double> latency;
+    bcp::LocationPrior prior;
+    bcp::InvoiceLayout layout;
+    layout.limits = limits;
+
+    std::string line;
+    std::getline(in, line);   // header
+    while (std::getline(in, line))
+    {
+        if (line.empty()) continue;
+
+        std::istringstream fields(line);
+        std::string name, tilt, y0, left, shift_x, shift_y;
+        std::getline(fields, name, ',');
+        std::getline(fields, tilt, ',');
+        std::getline(fields, y0, ',');
+        std::getline(fields, left, ',');
+        std::getline(fields, shift_x, ',');
+        std::getline(fields, shift_y, ',');
+
+        std::chrono::steady_clock::time_point t0 =
+            std::chrono::steady_clock::now();
+
+        bcp::Image<> page((dir + "/" + name).c_str());
+        bcp::__2Dcode_Extraction ext;
+        bcp::Extract2DCodes(page, layout, ext,
+            bcp::SerialPolicy(), warm? &prior: NULL);
+
+        double ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - t0).count();
+        latency.push_back(ms);
+
+        int true_y0 = atoi(y0.c_str()), true_left = atoi(left.c_str());
+        if (ext.box_x0 != layout.target_x0 || ext.box_y0 != layout.target_y0)
+        {
+            // the same as RenderSyntheticInvoice(), from the moved box
+            double t = atof(tilt.c_str()), theta = atan(t);
+            double ax = bcp::__synth_code_x + atoi(shift_x.c_str()) -
+                (ext.box_x0 - layout.target_x0);
+            double ay = bcp::__synth_code_y + atoi(shift_y.c_str()) -
+                (ext.box_y0 - layout.target_y0);
+            true_y0   = (int)floor(ay - ax * t + 0.5);
+            true_left = (int)floor(ax * cos(theta) + ay * sin(theta) + 0.5);
+        }
+
+        int dy    = abs(ext.loc.y0 - true_y0);
+        int dleft = abs(ext.left - true_left);
+        double dtilt = fabs(ext.loc.tilt - atof(tilt.c_str())) *
+            bcp::DefaultInvoiceLayout::target_width;
+        bool passed = ext.ok() && dy <= tolerance && dleft <= tolerance &&
+            dtilt <= tolerance;
+
+        std::string result = passed? "pass": "FAIL";
+        if (!ext.ok())
+            result = result + " (" + bcp::RejectReasonName(ext.reason) + ")";
+        printf("%s,%d,%.6f,%d,%.2f,%s\n", name.c_str(), ext.loc.y0,
+            ext.loc.tilt, ext.left, ms, result.c_str());
+
+        n_pages++;
+        n_passed += passed? 1: 0;
+        n_rejected += ext.ok()? 0: 1;
+        sum_dy += dy; sum_dleft += dleft; sum_dtilt += dtilt;
+        max_dy = dy > max_dy? dy: max_dy;
+        max_dleft = dleft > max_dleft? dleft: max_dleft;
+    }
+
+    if (n_pages == 0) return 1;
+    std::sort(latency.begin(), latency.end());
+
+    fprintf(stderr,
+        "pages: %d, passed: %d (%.1f%%), rejected: %d\n"
+        "y0 error: mean %.2f max %d, left error: mean %.2f max %d, "
+        "tilt error: mean %.2f px\n"
+        "latency(ms): p50 %.2f p99 %.2f max %.2f\n",
+        n_pages, n_passed, 100.0 * n_passed / n_pages, n_rejected,
+        sum_dy / n_pages, max_dy, sum_dleft / n_pages, max_dleft,
+        sum_dtilt / n_pages, latency[latency.size() / 2],
+        latency[(latency.size() * 99) / 100], latency.back());
+    if (warm)
+        fprintf(stderr, "warm-started: %d of %d pages\n",
+            prior.n_warm, prior.n_pages);
+
+    return n_passed == n_pages? 0: 1;
+}
+
+
+static void usage(const char *prog)
+{
+    std::cerr
+        << "usage: " << prog << " [options] output_dir\n"
+        << "       " << prog << " --verify truth.csv [--tolerance px] [--warm]\n"
+        << "       " << std::string(strlen(prog), ' ')
+        << " [--search-margin px] [--max-line px] [--speckle r]\n"
+        << "options:\n"
+        << "  -n count          number of pages (default 100)\n"
+        << "  --seed n          random seed (default 1)\n"
+        << "  --max-tilt deg    tilt of the code row (default 1.5)\n"
+        << "  --max-shift px    shift of the code row (default 8)\n"
+        << "  --max-overlap px  box border overlapping the codes (default 20)\n"
+        << "  --max-noise sd    pixel noise (default 25)\n"
+        << "  --max-blur r      box blur radius (default 2)\n"
+        << "  --max-gradient g  lighting falloff, 0..1 (default 0.4)\n"
+        << "  --feeder          tilt and shift drift slowly across pages\n";
+}
+
+int main(int argc, char *argv[])
+{
+    gen_options opt;
+    opt.count = 100;
+    opt.seed  = 1;
+    opt.max_tilt = 1.5;
+    opt.max_shift = 8;
+    opt.max_overlap = 20;
+    opt.max_noise = 25;
+    opt.max_blur = 2;
+    opt.max_gradient = 0.4;
+    opt.feeder = false;
+
+    std::string dir, truth;
+    int tolerance = 3;
+    bool warm = false;
+    bcp::ExtractionLimits limits;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (has_value && arg == "-n")                    opt.count = atoi(argv[++i]);
+        else if (has_value && arg == "--seed")           opt.seed = atoi(argv[++i]);
+        else if (has_value && arg == "--max-tilt")       opt.max_tilt = atof(argv[++i]);
+        else if (has_value && arg == "--max-shift")      opt.max_shift = atoi(argv[++i]);
+        else if (has_value && arg == "--max-overlap")    opt.max_overlap = atoi(argv[++i]);
+        else if (has_value && arg == "--max-noise")      opt.max_noise = atof(argv[++i]);
+        else if (has_value && arg == "--max-blur")       opt.max_blur = atoi(argv[++i]);
+        else if (has_value && arg == "--max-gradient")   opt.max_gradient = atof(argv[++i]);
+        else if (has_value && arg == "--verify")         truth = argv[++i];
+        else if (has_value && arg == "--tolerance")      tolerance = atoi(argv[++i]);
+        else if (has_value && arg == "--search-margin")  limits.search_margin = atoi(argv[++i]);
+        else if (has_value && arg == "--max-line")       limits.max_line_thickness = atoi(argv[++i]);
+        else if (has_value && arg == "--speckle")        limits.speckle_radius = atoi(argv[++i]);
+        else if (arg == "--feeder")                      opt.feeder = true;
+        else if (arg == "--warm")                        warm = true;
+        else if (arg[0] != '-' && dir.empty())           dir = arg;
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    try
+    {
+        if (!truth.empty())  return verify(truth, tolerance, warm, limits);
+        if (!dir.empty())    return generate(opt, dir);
+    }
+    catch (bcp::exception &e) {
+        std::cerr << e.message() << std::endl;
+        return 2;
+    }
+
+    usage(argv[0]);
+    return 2;
+}
@@ -1,86 +1,333 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
 #include "bcp_image.hpp"
 #include "ppm_io.hpp"
 
-#include <algorithm>
-#include <iterator>
+#include "bcp_extract.hpp"
+#include "bcp_pack.hpp"
+#include "bcp_cache.hpp"
 
-#include "bcp_locate.hpp"
 
+/* Stem of the names of the output files of an input: its name without the
+   directories and the extension, "stdin" for "-" */
+static std::string input_stem(const char *ppm_filename)
+{
+    std::string stem(strcmp(ppm_filename, "-") == 0? "stdin": ppm_filename);
+    std::string::size_type slash = stem.rfind('/');
+    if (slash != std::string::npos)
+        stem = stem.substr(slash + 1);
+    std::string::size_type dot = stem.rfind('.');
+    if (dot != std::string::npos && dot > 0)
+        stem = stem.substr(0, dot);
+    return stem;
+}
+
+/* The stems of all the inputs, made unique: files of the same name in
+   different directories would write the same outputs, at the same time when
+   the writes are asynchronous. The first input of a name keeps it, the next
+   ones get "-2", "-3"... appended. */
+static std::vector<std::string> input_stems(int n_inputs, char *inputs[])
+{
+    std::vector<std::string> stems;
+    std::set<std::string> plain, used;
+    for (int i = 0; i < n_inputs; i++) {
+        stems.push_back(input_stem(inputs[i]));
+        plain.insert(stems.back());
+    }
+
+    for (int i = 0; i < n_inputs; i++)
+    {
+        std::string stem = stems[i];
+        for (int k = 2; used.count(stems[i]) > 0; k++)
+        {
+            std::ostringstream numbered;
+            numbered << stem << "-" << k;
+            if (plain.count(numbered.str()) == 0)
+                stems[i] = numbered.str();
+        }
+        used.insert(stems[i]);
+    }
+    return stems;
+}
+
+/* Name of an output file of the image_no-th image of `ppm_filename', whose
+   outputs are named after `stem'. With a single input image the outputs are
+   named as they always were, with several of them they're prefixed by the
+   stem and, for the images after the first one of a stream, by the number
+   of the image. */
+static std::string output_name(const char *ppm_filename,
+    const std::string &stem, int image_no, const std::string &what,
+    bool prefixed)
+{
+    bool from_stdin = strcmp(ppm_filename, "-") == 0;
+    if (!prefixed && !from_stdin && image_no == 1)
+        return what + ".ppm";
+
+    std::ostringstream name;
+    name << stem;
+    if (from_stdin || image_no > 1)
+        name << "_" << image_no;
+    name << "_" << what << ".ppm";
+    return name.str();
+}
 
 
 int main(int argc, char *argv[])
 {
-    const bcp::size_type
-        target_x0    = 1350, target_y0     = 232,
-        target_width = 1212, target_height = 428,
-        code_size = 216, code_left = 250, code_padding = 10;
+    int n_threads = 1;             // -j n: process each image with n threads
+    const char *layout_file = NULL;    // -c file: load layouts from file
+    const char *layout_name = NULL;    // -l name: use this layout for all
+    bool warm_start = false;       // -w: the images come from one feeder
+    bool streaming = false;        // -s: load only the target box
+    const char *pack_file = NULL;  // -o file: append the results to a pack
+    int search_margin = -1;        // -a px: look for the codes around the
+                                   // target box, see ExtractionLimits
+    const char *cache_dir = NULL;  // -k dir: keep the results in a cache
+    int cache_mb = 256;            // -m mb: size bound of the cache
+
+    int arg = 1;
+    for ( ; arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0'; arg++)
+    {
+        if (strcmp(argv[arg], "-w") == 0)
+            warm_start = true;
+        else if (strcmp(argv[arg], "-s") == 0)
+            streaming = true;
+        else if (arg + 1 >= argc)
+            break;
+        else if (strcmp(argv[arg], "-j") == 0)
+            n_threads = atoi(argv[++arg]);
+        else if (strcmp(argv[arg], "-c") == 0)
+            layout_file = argv[++arg];
+        else if (strcmp(argv[arg], "-l") == 0)
+            layout_name = argv[++arg];
+        else if (strcmp(argv[arg], "-o") == 0)
+            pack_file = argv[++arg];
+        else if (strcmp(argv[arg], "-a") == 0)
+            search_margin = atoi(argv[++arg]);
+        else if (strcmp(argv[arg], "-k") == 0)
+            cache_dir = argv[++arg];
+        else if (strcmp(argv[arg], "-m") == 0)
+            cache_mb = atoi(argv[++arg]);
+        else
+            break;
+    }
 
-    if (argc == 2)
+    if (arg >= argc || (argv[arg][0] == '-' && argv[arg][1] != '\0'))
     {
-        try
+        std::cout << "usage: " << argv[0]
+                  << " [-j threads] [-c layout_file] [-l layout] [-w] [-s]"
+                  << " [-o pack_file] [-a margin] [-k cache_dir] [-m cache_mb]"
+                  << " ppm_filename... (- for stdin)" << std::endl;
+        return 0;
+    }
+
+    if (cache_mb <= 0) {
+        std::cout << "Invalid cache size: " << cache_mb << " MB" << std::endl;
+        return 1;
+    }
+
+    int n_failed = 0;
+    try
+    {
+        bcp::ThreadPoolExecution pool(n_threads);
+
+        // the default layout, unless a layout file is given
+        std::vector<bcp::InvoiceLayout> layouts(1);
+        if (layout_file != NULL)
+            layouts = bcp::LoadInvoiceLayouts(layout_file);
+        if (search_margin >= 0)
+        {
+            for (size_t i = 0; i < layouts.size(); i++)
+                layouts[i].limits.search_margin = search_margin;
+        }
+
+        const bcp::InvoiceLayout *forced_layout = NULL;
+        if (layout_name != NULL)
         {
-            std::cout << "Loading image..." << std::endl;
-            bcp::Image<> ppm_img(argv[1]);
+            forced_layout = bcp::FindInvoiceLayout(layouts, layout_name);
+            if (forced_layout == NULL) {
+                std::cout << "No such layout: " << layout_name << std::endl;
+                return 1;
+            }
+        }
+
+        /* with -w, the tilt search of a page starts from the previous page
+           of the same layout */
+        std::map<const bcp::InvoiceLayout *, bcp::LocationPrior> priors;
+
+        /* with -o, the results of all the images go to a single pack file
+           instead of a PPM file per part */
+        std::unique_ptr<bcp::PackWriter> pack;
+        if (pack_file != NULL)
+            pack.reset(new bcp::PackWriter(pack_file));
 
-            // Crop (roughly) and threshold the image
-            std::cout << "Thresholding..." << std::endl;
-            bcp::Image<bcp::pixel_Monochrome> ppm_mono = 
-                ppm_img.crop(
-                    target_x0, target_x0 + target_width, 
-                    target_y0, target_y0 + target_height).threshold();
+        /* with -k, pages seen before get their results from the cache
+           instead of being extracted again, see bcp_cache.hpp */
+        std::unique_ptr<bcp::ResultCache> cache;
+        if (cache_dir != NULL)
+            cache.reset(new bcp::ResultCache(cache_dir,
+                (uint64_t)cache_mb << 20));
 
-            ppm_mono.save_ppm("thresholded.ppm");
+        /* inputs are read ahead and outputs written behind the extraction,
+           see bcp_asyncio.hpp */
+        std::unique_ptr<bcp::AsyncFileIO> io = bcp::OpenAsyncFileIO();
 
-            // Horizonal tilt calibration and crop precisely
-            std::cout << "Tomography projection..." << std::endl;
-            bcp::__2Dcode_Location loc = 
-                bcp::Locate2DCode(ppm_mono, 50, code_size);
+        std::cout << "Pixel kernels: " << bcp::PixelKernels().name << std::endl;
+        std::cout << "File I/O: " << io->name() << std::endl;
+
+        bool prefixed = argc - arg > 1;
+        std::vector<std::string> stems = input_stems(argc - arg, argv + arg);
+        for (int input_no = 0; arg < argc; arg++, input_no++)
+        {
+            /* the next inputs are read while this one is processed, but
+               when streaming, which reads only the target box, and for
+               pipes and the like, which are read as they come */
+            for (int next = arg + 1; next <= arg + 2 && next < argc; next++)
+            {
+                if (!streaming && strcmp(argv[next], "-") != 0 &&
+                    bcp::IsRegularFile(argv[next]))
+                    io->prefetch(argv[next]);
+            }
 
-            bcp::Image<bcp::pixel_Monochrome> img_crop_h = 
-                ppm_mono.rotate(std::atan(loc.tilt), 0, 0).
-                crop(0, 0 + target_width,
-                    loc.y0, loc.y0 + code_size);
+            /* an input may hold several images one after another, "-" reads
+               them from stdin */
+            try
+            {
+                /* when streaming, the file is read as it's parsed rather
+                   than loaded whole by io */
+                std::unique_ptr<bcp::PPMStripReader> input(streaming?
+                    new bcp::PPMStripReader(argv[arg]):
+                    new bcp::PPMStripReader(*io, argv[arg]));
+                bcp::PPMStripReader &reader = *input;
+                int image_no = 1;
+                do {
+                    /* the whole image is loaded, unless streaming where
+                       only the target box is read */
+                    std::cout << "Loading image " << argv[arg];
+                    if (image_no > 1) std::cout << " #" << image_no;
+                    std::cout << "..." << std::endl;
 
-            // img_crop_h.save_ppm("cropped.ppm");
+                    bcp::size_type width = reader.get_width(),
+                                   height = reader.get_height();
+                    bcp::Image<> ppm_img;
+                    if (!streaming)
+                        reader.read_image(ppm_img);
 
+                    const bcp::InvoiceLayout *layout = forced_layout;
+                    if (layout == NULL)
+                        layout = bcp::SelectInvoiceLayout(
+                            layouts, width, height);
+                    if (layout == NULL) {
+                        std::cout << "No layout for pages of "
+                                  << width << "x" << height << std::endl;
+                        n_failed++;
+                        continue;
+                    }
 
-            std::cout << "Splitting 2D codes..." << std::endl;
+                    /* Threshold, locate and split the 2D codes, unless the
+                       page is in the cache. Streamed pages are never read
+                       whole, they can't be looked up. */
+                    bcp::__2Dcode_Extraction ext;
+                    bcp::CacheKey key;
+                    bool cached = false;
+                    if (cache && !streaming)
+                    {
+                        key = bcp::MakeCacheKey(ppm_img, *layout);
+                        cached = cache->lookup(key, ext);
+                    }
 
-            // Vertical crop
-            bcp::Image<bcp::pixel_Monochrome> img_trans = img_crop_h.transpose();
-            std::vector<int> tomo_array = bcp::TomographyProjection(img_trans, 0);
-            bcp::__PiecewiseIntegration(tomo_array.begin(), tomo_array.end(), code_size);
+                    std::cout << (cached? "Found 2D codes in cache":
+                                  "Extracting 2D codes")
+                              << " (layout: " << layout->name << ")..."
+                              << std::endl;
+                    bcp::LocationPrior *prior =
+                        warm_start? &priors[layout]: NULL;
+                    if (streaming)
+                        bcp::Extract2DCodes(reader, *layout, ext, pool, prior);
+                    else if (!cached)
+                    {
+                        bcp::Extract2DCodes(ppm_img, *layout, ext, pool, prior);
+                        if (cache)
+                            cache->store(key, ext);
+                    }
 
-            // estimate the position of the first 2D code
-            std::vector<int>::iterator itr = 
-                std::max_element(tomo_array.begin(), tomo_array.begin() + code_left);
+                    if (layout->limits.search_margin > 0)
+                        std::cout << "target box: " << ext.box_x0 << " "
+                                  << ext.box_y0 << std::endl;
 
-            bcp::index_type  top = (bcp::index_type)(itr - tomo_array.begin());
-            std::cout << "position: " << top << std::endl;
+                    if (pack) {
+                        std::ostringstream doc_id;
+                        doc_id << argv[arg];
+                        if (image_no > 1) doc_id << "#" << image_no;
+                        pack->append(doc_id.str(), ext);
+                    }
 
+                    if (!ext.ok()) {
+                        std::cout << "status: rejected ("
+                                  << bcp::RejectReasonName(ext.reason) << ")"
+                                  << std::endl;
+                        continue;
+                    }
 
-            // Saving splitted 2D codes
-            img_trans.crop(0, code_size, top, top + code_size).transpose().save_ppm("part_1.ppm"); 
-            top += (code_size + code_padding);
+                    std::cout << "status: ok" << std::endl;
+                    std::cout << "position: " << ext.left << std::endl;
+                    if (pack)
+                        continue;
 
-            img_trans.crop(0, code_size, top, top + code_size).transpose().save_ppm("part_2.ppm");
-            top += (code_size + code_padding);
+                    ext.thresholded.save_ppm(*io, output_name(argv[arg],
+                        stems[input_no], image_no, "thresholded",
+                        prefixed).c_str());
 
-            img_trans.crop(0, code_size, top, top + code_size).transpose().save_ppm("part_3.ppm");
-            top += (code_size + code_padding);
+                    /* Saving splitted 2D codes, but those which don't
+                       look like a code enough to be worth decoding */
+                    for (size_t i = 0; i < ext.parts.size(); i++)
+                    {
+                        std::ostringstream part_name;
+                        part_name << "part_" << (i + 1);
 
-            img_trans.crop(0, code_size, top, top + code_size).transpose().save_ppm("part_4.ppm");
-            top += (code_size + code_padding);
+                        double score = ext.scores[i].score;
+                        std::cout << part_name.str() << ": score "
+                                  << std::setprecision(2) << score;
+                        if (score < layout->limits.min_part_score) {
+                            std::cout << ", skipped" << std::endl;
+                            continue;
+                        }
+                        std::cout << std::endl;
+
+                        ext.parts[i].save_ppm(*io, output_name(argv[arg],
+                            stems[input_no], image_no, part_name.str(),
+                            prefixed).c_str());
+                    }
+                } while (image_no++, reader.next_image());
+            }
+            catch(bcp::exception &e) {
+                std::cout << e.message() << std::endl;
+                n_failed++;
+            }
+        }
+
+        // wait for the outputs still being written
+        try {
+            io->flush();
         }
         catch(bcp::exception &e) {
             std::cout << e.message() << std::endl;
+            n_failed++;
         }
     }
-    else {
-        std::cout << "usage: " << argv[0] << " ppm_filename" << std::endl;
+    catch(bcp::exception &e) {
+        std::cout << e.message() << std::endl;
+        return 1;
     }
 
-    return 0;
+    return n_failed > 0? 1: 0;
 }
-
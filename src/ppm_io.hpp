@@ -5,9 +5,14 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include <vector>
 
 #include "bcp_image_def.hpp"
 #include "bcp_exception.hpp"
+#include "bcp_asyncio.hpp"
 
 
 __BCP_BEGIN_NAMESPACE
@@ -26,7 +31,7 @@ enum __PPM_FILE_FORMAT_type
    This function reads the pixel in RGB format and returns the color component 
    expansions through parameters red, green and blue.
 */
-void __load_ppm_pixel_data(
+inline void __load_ppm_pixel_data(
     FILE *fp, int &red, int &green, int &blue, __PPM_FILE_FORMAT_type format)
 {
     switch (format)
@@ -53,49 +58,72 @@ void __load_ppm_pixel_data(
 /* PPM header has been parsed by __load_ppm_image, PPM file format and image size has 
    already been determined. Now this function is invoked to read all actual pixel data
    into the image object.
+
+   Pixels are read a row at a time, a single fread for binary files, and then
+   converted to the pixel type of the image by the ConvertPixel() overload
+   for the two types.
 */
 template <typename _pixel_type>
 void __load_ppm_image_data(
     FILE *fp, Image<_pixel_type> &image, __PPM_FILE_FORMAT_type format)
 {
-    for (index_type y = 0; y < image.get_height(); y++)
+    size_type width = image.get_width();
+    std::vector<pixel_RGB> row(width);
+
+    try
     {
-        for (index_type x = 0; x < image.get_width(); x++)
+        for (index_type y = 0; y < image.get_height(); y++)
         {
-            // pick up the pixel in RGB format
-            int  red, green, blue;
-            __load_ppm_pixel_data(fp, red, green, blue, format);
+            // pick up a row of pixels in RGB format
+            if (format == PPM_FORMAT_PPM6)
+            {
+                if (fread(row.data(), sizeof(pixel_RGB), width, fp) !=
+                    (size_t)width)
+                    throw invalid_ppm_image();
+            }
+            else
+            {
+                for (index_type x = 0; x < width; x++) {
+                    int red, green, blue;
+                    __load_ppm_pixel_data(fp, red, green, blue, format);
+                    row[x] = pixel_RGB(red, green, blue);
+                }
+            }
 
-            // convert the RGB pixel to what we really want
-            image(x,y) = ConvertPixel(pixel_RGB(red, green, blue), image(0,0));
+            // convert the RGB pixels to what we really want
+            _pixel_type *dst = image.get_pixels() + (size_t)y * width;
+            for (index_type x = 0; x < width; x++) {
+                dst[x] = ConvertPixel(row[x], _pixel_type());
+            }
         }
     }
+    catch (...) {
+        fclose(fp);
+        throw;
+    }
 
     fclose(fp);
 }
 
-// open specified .ppm image file and load all pixel informations to *image 
-template <typename _pixel_type>
-void __load_ppm_image(const char *filename, Image<_pixel_type> &image)
-{
 #define PPM_LINE_WIDTH 71  /* max number of characters in a line */
 
-    FILE *fp = fopen(filename, "rb");
+/* Parse the PPM header at the current position of fp, the format and the
+   image size are returned through the parameters. Returns false when the
+   magic number is not recognized. */
+inline bool __load_ppm_header(FILE *fp, __PPM_FILE_FORMAT_type &file_format,
+    size_type &width, size_type &height)
+{
     char tmp_buf[PPM_LINE_WIDTH];  // temporary buffer for fd
 
-    if (fp == NULL) 
-        throw cannot_open_file(filename);
-
     // read ppm header, the first line of a .ppm file should be the magic number: "PX"
-    __PPM_FILE_FORMAT_type file_format;
-    fscanf(fp, "%s", tmp_buf);
+    if (fscanf(fp, "%70s", tmp_buf) != 1)
+        return false;
 
     if (strcmp(tmp_buf, "P3") == 0)       file_format = PPM_FORMAT_PPM3;
     else if (strcmp(tmp_buf, "P6") == 0)  file_format = PPM_FORMAT_PPM6;
     else {
         // the header of this .ppm file is unexpected
-        fclose(fp);
-        throw unrecognized_ppm_format();
+        return false;
     }
 
     /* skip comments: comments should appear only at top of the file and starts
@@ -112,20 +140,272 @@ void __load_ppm_image(const char *filename, Image<_pixel_type> &image)
 
     // image size (width and height in px) and max pixel were given right after
     // all comments
+    if (fscanf(fp, "%d %d %*d", &width, &height) != 2 ||
+        width <= 0 || height <= 0)
+        throw invalid_ppm_image();
+
+    fgets(tmp_buf, PPM_LINE_WIDTH, fp); /* skip the comming whitespace */
+    return true;
+}
+
+// open specified .ppm image file and load all pixel informations to *image 
+template <typename _pixel_type>
+void __load_ppm_image(const char *filename, Image<_pixel_type> &image)
+{
+    FILE *fp = fopen(filename, "rb");
+
+    if (fp == NULL) 
+        throw cannot_open_file(filename);
+
+    __PPM_FILE_FORMAT_type file_format;
     size_type width, height;
-    fscanf(fp, "%d %d %*d", &width, &height);
+    try
+    {
+        if (!__load_ppm_header(fp, file_format, width, height))
+            throw unrecognized_ppm_format();
+    }
+    catch (...) {
+        fclose(fp);
+        throw;
+    }
     image = Image<_pixel_type>(width, height);
 
     /* read all pixels according to the .ppm file format */
-    fgets(tmp_buf, PPM_LINE_WIDTH, fp); /* skip the comming whitespace */
     __load_ppm_image_data(fp, image, file_format);
-
+}
 
 #undef PPM_LINE_WIDTH
+
+
+/* Reads PPM images strip by strip, from top to bottom, so that only the
+   rows in use have to be kept in memory. A stream may hold several images
+   one after another, as netpbm allows, next_image() moves on to the next
+   one. Streams can be files, pipes or stdin, they're read ahead through a
+   large stdio buffer. */
+class PPMStripReader
+{
+public:
+    // open a file and read the header of its first image, "-" is stdin
+    PPMStripReader(const char *filename)
+        : fp(NULL), owned(true), width(0), height(0), row(0)
+    {
+        open_stream(filename);
+        first_image();
+    }
+
+    /* the same, with a regular file read through `io', which may have
+       prefetched it: the whole file is kept in memory and parsed from
+       there. "-", pipes and other files which aren't regular are still
+       read as they come. */
+    PPMStripReader(AsyncFileIO &io, const char *filename)
+        : fp(NULL), owned(true), width(0), height(0), row(0)
+    {
+        if (strcmp(filename, "-") == 0 || !IsRegularFile(filename))
+            open_stream(filename);
+        else
+        {
+            io.read_file(filename, contents);
+            if (contents.empty())
+                throw unrecognized_ppm_format();
+            if ((fp = fmemopen(&contents[0], contents.size(), "rb")) == NULL)
+                throw cannot_open_file(filename);
+        }
+        first_image();
+    }
+
+    /* read the images of a stream which is already open, call next_image()
+       for the first one. The stream is not closed. */
+    PPMStripReader(FILE *stream)
+        : fp(stream), owned(false), width(0), height(0), row(0) {}
+
+    // read the images of a file descriptor, which is not closed either
+    PPMStripReader(int fd)
+        : fp(NULL), owned(true), width(0), height(0), row(0)
+    {
+        int fd_copy = dup(fd);
+        if (fd_copy < 0 || (fp = fdopen(fd_copy, "rb")) == NULL) {
+            if (fd_copy >= 0) close(fd_copy);
+            throw cannot_open_specified_file();
+        }
+        setvbuf(fp, NULL, _IOFBF, __read_ahead);
+    }
+
+    ~PPMStripReader(void) {
+        if (owned) fclose(fp);
+    }
+
+    /* move on to the next image of the stream and read its header, the rows
+       of the current image which were not read are skipped. Returns false
+       at the end of the stream. */
+    bool next_image(void)
+    {
+        skip_rows(height - row);
+        width = height = row = 0;
+
+        int c;
+        while ((c = getc(fp)) != EOF && isspace(c)) {}
+        if (c == EOF)
+            return false;
+        ungetc(c, fp);
+
+        if (!__load_ppm_header(fp, format, width, height))
+            throw unrecognized_ppm_format();
+        return true;
+    }
+
+    size_type get_width(void)  const { return width; }
+    size_type get_height(void) const { return height; }
+
+    // index of the next row to be read
+    index_type next_row(void) const { return row; }
+
+    // read the next n_rows rows into rows[n_rows * width]
+    void read_rows(size_type n_rows, pixel_RGB *rows)
+    {
+        if (n_rows <= 0) return;
+        if (row + n_rows > height)
+            throw invalid_ppm_image();
+
+        size_t n = (size_t)n_rows * width;
+        if (format == PPM_FORMAT_PPM6)
+        {
+            if (fread(rows, sizeof(pixel_RGB), n, fp) != n)
+                throw invalid_ppm_image();
+        }
+        else
+        {
+            for (size_t i = 0; i < n; i++) {
+                int red, green, blue;
+                __load_ppm_pixel_data(fp, red, green, blue, format);
+                rows[i] = pixel_RGB(red, green, blue);
+            }
+        }
+        row += n_rows;
+    }
+
+    // skip the next n_rows rows
+    void skip_rows(size_type n_rows)
+    {
+        if (n_rows <= 0) return;
+        if (row + n_rows > height)
+            throw invalid_ppm_image();
+
+        if (format == PPM_FORMAT_PPM6 && fseek(fp,
+                (long)n_rows * width * (long)sizeof(pixel_RGB), SEEK_CUR) == 0)
+        {
+            row += n_rows;
+            return;
+        }
+
+        // not seekable (or text format), read them through
+        std::vector<pixel_RGB> strip((size_t)width * __strip_rows);
+        while (n_rows > 0)
+        {
+            size_type n = n_rows < __strip_rows? n_rows: __strip_rows;
+            read_rows(n, &strip[0]);
+            n_rows -= n;
+        }
+    }
+
+    // read the rest of the current image into `image'
+    template <typename _pixel_type>
+    void read_image(Image<_pixel_type> &image)
+    {
+        image = Image<_pixel_type>(width, height - row);
+
+        std::vector<pixel_RGB> strip((size_t)width * __strip_rows);
+        for (index_type y = 0; y < image.get_height(); )
+        {
+            size_type n = image.get_height() - y < __strip_rows?
+                image.get_height() - y: __strip_rows;
+            read_rows(n, &strip[0]);
+
+            _pixel_type *dst = image.get_pixels() + (size_t)y * width;
+            for (size_t i = 0; i < (size_t)n * width; i++) {
+                dst[i] = ConvertPixel(strip[i], _pixel_type());
+            }
+            y += n;
+        }
+    }
+
+    // rows read or skipped at a time
+    static const size_type __strip_rows = 64;
+
+    // size of the read-ahead buffer of streams we open
+    static const size_t __read_ahead = 1 << 20;
+
+private:
+    PPMStripReader(const PPMStripReader &);
+    const PPMStripReader & operator = (const PPMStripReader &);
+
+    // open a file through stdio, "-" is stdin
+    void open_stream(const char *filename)
+    {
+        if (strcmp(filename, "-") == 0)
+            fp = stdin, owned = false;
+        else if ((fp = fopen(filename, "rb")) == NULL)
+            throw cannot_open_file(filename);
+        setvbuf(fp, NULL, _IOFBF, __read_ahead);
+    }
+
+    // read the header of the first image of a stream we opened
+    void first_image(void)
+    {
+        try
+        {
+            if (!next_image())
+                throw unrecognized_ppm_format();
+        }
+        catch (...) {
+            if (owned) fclose(fp);
+            throw;
+        }
+    }
+
+    FILE *fp;
+    bool owned;            // whether fp is closed by us
+    std::vector<byte> contents;    // of a file read through AsyncFileIO
+    __PPM_FILE_FORMAT_type format;
+    size_type width, height;
+    index_type row;
+};
+
+/* Load the rect [left, right] x [top, bottom] of the image being read by
+   `reader' into `region', the rows above it are skipped and the rows below
+   it are not read. Only a strip of rows is buffered at a time. */
+template <typename _pixel_type>
+void __load_ppm_region(PPMStripReader &reader,
+    index_type left, index_type right, index_type top, index_type bottom,
+    Image<_pixel_type> &region)
+{
+    if (left < 0 || top < reader.next_row() || left > right || top > bottom ||
+        right >= reader.get_width() || bottom >= reader.get_height())
+        throw invalid_ppm_image();
+
+    size_type width = right - left + 1, height = bottom - top + 1;
+    region = Image<_pixel_type>(width, height);
+    reader.skip_rows(top - reader.next_row());
+
+    const size_type strip_rows = PPMStripReader::__strip_rows;
+    std::vector<pixel_RGB> strip((size_t)reader.get_width() * strip_rows);
+    for (index_type y = 0; y < height; )
+    {
+        size_type n = height - y < strip_rows? height - y: strip_rows;
+        reader.read_rows(n, &strip[0]);
+
+        for (index_type i = 0; i < n; i++, y++)
+        {
+            const pixel_RGB *src = &strip[(size_t)i * reader.get_width() + left];
+            for (index_type x = 0; x < width; x++) {
+                region(x,y) = ConvertPixel(src[x], _pixel_type());
+            }
+        }
+    }
 }
 
 
-// Save the image object to a PPM6 file (binary format)
+/* Save the image object to a PPM6 file (binary format), a row at a time:
+   the pixels of a row are converted to RGB and written at once */
 template <typename _pixel_type>
 void __save_ppm_image(const char *ppm_filename, const Image<_pixel_type> &img)
 {
@@ -137,22 +417,55 @@ void __save_ppm_image(const char *ppm_filename, const Image<_pixel_type> &img)
     fprintf(fp, "P6\n");
     fprintf(fp, "%d %d %d\n", img.get_width(), img.get_height(), 255);
 
+    size_type width = img.get_width();
+    std::vector<pixel_RGB> row(width);
     for (index_type y = 0; y < img.get_height(); y++)
     {
-        for (index_type x = 0; x < img.get_width(); x++)
-        {
-            // get RGB format pixel from the image
-            pixel_RGB rgb = ConvertPixel(img(x,y), pixel_RGB());
-            // write to file
-            fwrite(&(rgb.r), 1,1, fp);
-            fwrite(&(rgb.g), 1,1, fp);
-            fwrite(&(rgb.b), 1,1, fp);
+        // get RGB format pixels from the image
+        const _pixel_type *src = img.get_pixels() + (size_t)y * width;
+        for (index_type x = 0; x < width; x++) {
+            row[x] = ConvertPixel(src[x], pixel_RGB());
         }
+        // write to file
+        fwrite(row.data(), sizeof(pixel_RGB), width, fp);
     }
 
     fclose(fp);   // done
 }
 
+// The bytes of a PPM6 file of the image
+template <typename _pixel_type>
+void __ppm_image_bytes(const Image<_pixel_type> &img, std::vector<byte> &bytes)
+{
+    char header[64];
+    int header_len = snprintf(header, sizeof(header), "P6\n%d %d %d\n",
+        img.get_width(), img.get_height(), 255);
+
+    size_type width = img.get_width();
+    bytes.resize(header_len + (size_t)width * img.get_height() * 3);
+    memcpy(&bytes[0], header, header_len);
+
+    pixel_RGB *dst = (pixel_RGB*)&bytes[header_len];
+    for (index_type y = 0; y < img.get_height(); y++, dst += width)
+    {
+        const _pixel_type *src = img.get_pixels() + (size_t)y * width;
+        for (index_type x = 0; x < width; x++) {
+            dst[x] = ConvertPixel(src[x], pixel_RGB());
+        }
+    }
+}
+
+/* Save the image to a PPM6 file through `io': the file is encoded in memory
+   and written later, errors show up at io.flush() */
+template <typename _pixel_type>
+void __save_ppm_image(AsyncFileIO &io, const char *ppm_filename,
+    const Image<_pixel_type> &img)
+{
+    std::vector<byte> bytes;
+    __ppm_image_bytes(img, bytes);
+    io.write_file(ppm_filename, bytes);
+}
+
 
 __BCP_END_NAMESPACE
 
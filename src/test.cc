@@ -0,0 +1,233 @@
+/*
+  Checks of edge cases of the bcp library, run by `make test'. Each check
+  prints a line and the program exits with status 1 if any of them failed.
+*/
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+#include <sstream>
+
+#include "bcp_image.hpp"
+#include "bcp_morph.hpp"
+#include "bcp_pack.hpp"
+
+
+static int n_failed = 0;
+
+static void check(bool ok, const std::string &what)
+{
+    printf("%s: %s\n", ok? "ok  ": "FAIL", what.c_str());
+    if (!ok) n_failed++;
+}
+
+
+/* ---------------------------------------------------------------------------
+   Morphology at the borders of the image
+   --------------------------------------------------------------------------- */
+
+// a white size x size image with a line of ink from (x0, y0), length pixels
+// long, vertical or horizontal
+static bcp::Image<bcp::pixel_Monochrome> line_image(int size,
+    int x0, int y0, int length, bool vertical)
+{
+    bcp::Image<bcp::pixel_Monochrome> img(size, size);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) img(x,y).val = 1;
+    }
+    for (int i = 0; i < length; i++) {
+        if (vertical) img(x0, y0 + i).val = 0;
+        else img(x0 + i, y0).val = 0;
+    }
+    return img;
+}
+
+static int count_ink(const bcp::Image<bcp::pixel_Monochrome> &img)
+{
+    int n = 0;
+    for (int y = 0; y < img.get_height(); y++) {
+        for (int x = 0; x < img.get_width(); x++) n += img(x,y).val == 0;
+    }
+    return n;
+}
+
+/* Lines touching each border: outside the image is paper, so a line
+   shorter than min_length is kept whichever border it touches, and a
+   longer one is removed */
+static void test_thin_lines_at_borders(void)
+{
+    const int size = 10;
+    struct { const char *border; int x0, y0; bool vertical; } cases[] = {
+        { "top",    4, 0, true  },
+        { "bottom", 4, -1, true  },
+        { "left",   0, 4, false },
+        { "right",  -1, 4, false },
+    };
+
+    for (int i = 0; i < 4; i++)
+    {
+        for (int length = 3; length <= 7; length += 4)
+        {
+            int x0 = cases[i].x0 < 0? size - length: cases[i].x0;
+            int y0 = cases[i].y0 < 0? size - length: cases[i].y0;
+            bcp::Image<bcp::pixel_Monochrome> img =
+                line_image(size, x0, y0, length, cases[i].vertical);
+
+            int left = count_ink(bcp::RemoveThinLines(img, 5, 1));
+            bool kept = length < 5;
+            check(left == (kept? length: 0), std::string("RemoveThinLines, ") +
+                (length < 5? "short": "long") + " line at the " +
+                cases[i].border + " border " + (kept? "kept": "removed"));
+        }
+    }
+}
+
+/* Erosion treats outside as ink and dilation as paper, the same on every
+   border: eroding a full image leaves it full, dilating a line along a
+   border grows it by the radius inwards only */
+static void test_morph_at_borders(void)
+{
+    const int size = 10;
+    bcp::Image<bcp::pixel_Monochrome> full = line_image(size, 0, 0, 0, true);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) full(x,y).val = 0;
+    }
+    check(count_ink(bcp::ErodeImage(full, 2, 2)) == size * size,
+        "ErodeImage keeps a full image full");
+
+    const char *borders[] = { "top", "bottom", "left", "right" };
+    for (int i = 0; i < 4; i++)
+    {
+        bool vertical = i >= 2;
+        int at = i % 2 == 0? 0: size - 1;
+        bcp::Image<bcp::pixel_Monochrome> img = vertical?
+            line_image(size, at, 0, size, true):
+            line_image(size, 0, at, size, false);
+        check(count_ink(bcp::DilateImage(img, 1, 1)) == 2 * size,
+            std::string("DilateImage of a line at the ") + borders[i] +
+            " border");
+    }
+}
+
+
+/* ---------------------------------------------------------------------------
+   Packed output files
+   --------------------------------------------------------------------------- */
+
+static std::string pack_name(void)
+{
+    std::ostringstream name;
+    name << "/tmp/bcp_test_" << getpid() << ".bcpk";
+    return name.str();
+}
+
+// an accepted result with a thresholded box and two parts of a few pixels
+static bcp::__2Dcode_Extraction sample_extraction(void)
+{
+    bcp::__2Dcode_Extraction ext;
+    ext.thresholded = line_image(13, 2, 5, 9, false);
+    ext.parts.push_back(line_image(9, 4, 0, 9, true));
+    ext.parts.push_back(line_image(10, 0, 0, 3, false));
+    ext.loc.tilt = 0.25, ext.loc.y0 = 17, ext.loc.confidence = 80;
+    ext.left = 42;
+    return ext;
+}
+
+static bool same_pixels(const bcp::Image<bcp::pixel_Monochrome> &a,
+    const bcp::Image<bcp::pixel_Monochrome> &b)
+{
+    if (a.get_width() != b.get_width() || a.get_height() != b.get_height())
+        return false;
+    for (int y = 0; y < a.get_height(); y++) {
+        for (int x = 0; x < a.get_width(); x++) {
+            if (a(x,y).val != b(x,y).val) return false;
+        }
+    }
+    return true;
+}
+
+/* What PackWriter appends is what PackReader reads back, for an accepted
+   document and a rejected one */
+static void test_pack_round_trip(void)
+{
+    std::string name = pack_name();
+    unlink(name.c_str());
+
+    bcp::__2Dcode_Extraction ext = sample_extraction(), rejected;
+    rejected.reject(bcp::REJECT_BLANK);
+    {
+        bcp::PackWriter writer(name.c_str());
+        writer.append("page", ext);
+        writer.append("blank page", rejected);
+    }
+
+    bcp::PackReader reader(name.c_str());
+    check(reader.n_documents() == 2, "PackReader reads all the documents");
+
+    const bcp::PackedDocument *doc = reader.find("page");
+    bool ok = doc != NULL && doc->status == bcp::EXTRACTION_OK &&
+        doc->tilt == 0.25 && doc->y0 == 17 && doc->confidence == 80 &&
+        doc->left == 42 && doc->parts.size() == 3 &&
+        same_pixels(doc->parts[0].unpack(), ext.thresholded) &&
+        same_pixels(doc->parts[1].unpack(), ext.parts[0]) &&
+        same_pixels(doc->parts[2].unpack(), ext.parts[1]);
+    check(ok, "PackReader reads back an accepted document");
+
+    doc = reader.find("blank page");
+    check(doc != NULL && doc->status == bcp::EXTRACTION_REJECTED &&
+        doc->reason == bcp::REJECT_BLANK && doc->parts.empty(),
+        "PackReader reads back a rejected document");
+
+    unlink(name.c_str());
+}
+
+/* A record whose part is too large for it is rejected as an invalid pack,
+   even when its size overflows */
+static void test_pack_corrupt_record(void)
+{
+    const uint32_t widths[] = { 1000, 0xFFFFFFFF, 0x80000000 };
+    for (int i = 0; i < 3; i++)
+    {
+        std::string name = pack_name();
+        unlink(name.c_str());
+        {
+            bcp::PackWriter writer(name.c_str());
+            writer.append("page", sample_extraction());
+        }
+
+        // the width of part 0, in the index after the id "page"
+        bcp::byte width[4];
+        for (int k = 0; k < 4; k++) width[k] = (bcp::byte)(widths[i] >> (8 * k));
+        FILE *fp = fopen(name.c_str(), "r+b");
+        fseek(fp, bcp::__pack_header_size + bcp::__record_header_size + 4 + 4,
+            SEEK_SET);
+        fwrite(width, 1, 4, fp);
+        fclose(fp);
+
+        bool rejected = false;
+        try {
+            bcp::PackReader reader(name.c_str());
+        }
+        catch (bcp::invalid_pack_file &) {
+            rejected = true;
+        }
+        std::ostringstream what;
+        what << "PackReader rejects a part of width 0x" << std::hex << widths[i];
+        check(rejected, what.str());
+
+        unlink(name.c_str());
+    }
+}
+
+
+int main(void)
+{
+    test_thin_lines_at_borders();
+    test_morph_at_borders();
+    test_pack_round_trip();
+    test_pack_corrupt_record();
+
+    printf("%d failed\n", n_failed);
+    return n_failed > 0? 1: 0;
+}